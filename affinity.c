@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <mpi.h>
+#include <omp.h>
+
+#define MAX_CPUS CPU_SETSIZE
+#define MAX_PATH 64
+
+static int getAllowedCpus(int *cpus);
+static int getSocketCpus(int *cpus);
+static int getSocket(int cpu);
+
+static enum Affinity pinAffinity = AFFINITY_NONE;
+static int pinCpus[MAX_CPUS];
+static int pinNumCpus = 0;
+static int pinNumThreads = 1;
+static _Thread_local int pinnedCpu = -1;
+
+/*
+ * Selects the CPUs for the threads of this process and pins each thread to
+ * one of them. With 'socket', each process of the host takes one socket, and
+ * the processes sharing a socket split its CPUs. Returns the number of threads
+ * to use, which is the number of CPUs of the socket when numThreads is 0.
+ */
+int setAffinity(enum Affinity affinity, int numThreads)
+{
+	int ownId;
+
+	if (affinity == AFFINITY_SOCKET)
+		pinNumCpus = getSocketCpus(pinCpus);
+	else
+		pinNumCpus = getAllowedCpus(pinCpus);
+
+	if (numThreads == 0) {
+		numThreads = affinity == AFFINITY_SOCKET?
+			pinNumCpus : omp_get_max_threads();
+	}
+	omp_set_num_threads(numThreads);
+
+	if (affinity == AFFINITY_NONE || pinNumCpus == 0) {
+		pinNumCpus = 0;
+		return numThreads;
+	}
+	pinAffinity = affinity;
+	pinNumThreads = numThreads;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &ownId);
+	if (ownId == 0 && omp_get_proc_bind() != omp_proc_bind_false) {
+		fprintf(stderr, "The threads are pinned by '--affinity', "
+			"not by OMP_PROC_BIND\n");
+	}
+
+	// The pages touched first by each thread are placed next to its CPU, so
+	// the threads are pinned before the world is initialized
+	#pragma omp parallel
+	pinThread();
+
+	return numThreads;
+}
+
+/*
+ * Pins the calling thread to the CPU of its number in the outermost team.
+ * The runtime may start new threads for a region, so it is called at the
+ * start of the work of every region, and only changes the affinity of the
+ * threads that are not on their CPU yet.
+ */
+void pinThread(void)
+{
+	cpu_set_t set;
+	int threadNum, cpu;
+
+	if (pinNumCpus == 0) return;
+
+	threadNum = omp_get_level() > 0? omp_get_ancestor_thread_num(1) : 0;
+	if (pinAffinity == AFFINITY_SPREAD)
+		cpu = pinCpus[(threadNum * pinNumCpus / pinNumThreads) % pinNumCpus];
+	else
+		cpu = pinCpus[threadNum % pinNumCpus];
+	if (cpu == pinnedCpu) return;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &set) == 0)
+		pinnedCpu = cpu;
+}
+
+static int getAllowedCpus(int *cpus)
+{
+	cpu_set_t set;
+	int cpu;
+	int numCpus = 0;
+
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &set) != 0) return 0;
+
+	for (cpu = 0; cpu < MAX_CPUS; ++cpu) {
+		if (CPU_ISSET(cpu, &set))
+			cpus[numCpus++] = cpu;
+	}
+
+	return numCpus;
+}
+
+/*
+ * CPUs of the socket of this process. The binding of the launcher is ignored,
+ * so all the online CPUs of the host are considered.
+ */
+static int getSocketCpus(int *cpus)
+{
+	MPI_Comm hostComm;
+	int hostRank, hostSize;
+	int sockets[MAX_CPUS];
+	int numSockets = 0;
+	int socket, sharers, share;
+	int hostCpus, cpu;
+	int i, numCpus;
+
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+		MPI_INFO_NULL, &hostComm);
+	MPI_Comm_rank(hostComm, &hostRank);
+	MPI_Comm_size(hostComm, &hostSize);
+	MPI_Comm_free(&hostComm);
+
+	hostCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (hostCpus > MAX_CPUS) hostCpus = MAX_CPUS;
+
+	// Sockets in order of their first CPU
+	for (cpu = 0; cpu < hostCpus; ++cpu) {
+		socket = getSocket(cpu);
+		for (i = 0; i < numSockets && sockets[i] != socket; ++i);
+		if (i == numSockets) sockets[numSockets++] = socket;
+	}
+	if (numSockets == 0) return getAllowedCpus(cpus);
+
+	if (hostRank == 0 && hostSize != numSockets) {
+		fprintf(stderr, "%d processes run in a host of %d sockets, "
+			"%s\n", hostSize, numSockets, hostSize < numSockets?
+			"some sockets stay idle" : "so they share sockets");
+	}
+
+	socket = sockets[hostRank % numSockets];
+	sharers = hostSize / numSockets +
+		(hostRank % numSockets < hostSize % numSockets);
+	share = hostRank / numSockets;
+
+	numCpus = 0;
+	for (cpu = 0; cpu < hostCpus; ++cpu) {
+		if (getSocket(cpu) == socket)
+			cpus[numCpus++] = cpu;
+	}
+
+	// Processes sharing the socket take consecutive slices of it, or one CPU
+	// when there are more processes than CPUs
+	if (numCpus < sharers) {
+		cpus[0] = cpus[share % numCpus];
+		return 1;
+	}
+
+	i = share * numCpus / sharers;
+	numCpus = (share + 1) * numCpus / sharers - i;
+	for (cpu = 0; cpu < numCpus; ++cpu)
+		cpus[cpu] = cpus[i + cpu];
+
+	return numCpus;
+}
+
+static int getSocket(int cpu)
+{
+	char path[MAX_PATH];
+	FILE *file;
+	int socket = 0;
+
+	snprintf(path, MAX_PATH,
+		"/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+		cpu);
+
+	file = fopen(path, "r");
+	if (file == NULL) return 0;
+	if (fscanf(file, "%d", &socket) != 1) socket = 0;
+	fclose(file);
+
+	return socket;
+}
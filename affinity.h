@@ -0,0 +1,14 @@
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+enum Affinity {
+	AFFINITY_NONE,
+	AFFINITY_COMPACT,
+	AFFINITY_SPREAD,
+	AFFINITY_SOCKET
+};
+
+int setAffinity(enum Affinity affinity, int numThreads);
+void pinThread(void);
+
+#endif
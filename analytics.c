@@ -0,0 +1,165 @@
+#include "analytics.h"
+#include "io.h"
+#include "malloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+// Generations whose reductions may be in flight at once
+#define PENDING 16
+// Room for a line of the time series
+#define MAX_LINE 160
+
+enum Sum {
+	SUM_POPULATION,
+	SUM_BIRTHS,
+	SUM_DEATHS,
+	SUM_ACTIVE_TILES,
+	NUM_SUMS
+};
+
+// The maximums are negated, so the whole box is reduced with MPI_MIN
+enum Bound {
+	BOUND_MIN_X,
+	BOUND_MIN_Y,
+	BOUND_MAX_X,
+	BOUND_MAX_Y,
+	NUM_BOUNDS
+};
+
+struct Reduction {
+	bool active;
+	unsigned long long int generation;
+	MPI_Request requests[2];
+
+	unsigned long long int sums[NUM_SUMS];
+	unsigned long long int totalSums[NUM_SUMS];
+	long int bounds[NUM_BOUNDS];
+	long int totalBounds[NUM_BOUNDS];
+};
+
+/*
+ * The census of each generation is reduced into the first process with
+ * non-blocking collectives, which are completed some generations later, so
+ * the processes never wait for each other to gather it. The first process
+ * keeps the time series in memory until the end of the run.
+ */
+struct Analytics {
+	int ownId;
+	struct Reduction reductions[PENDING];
+	unsigned int next;
+
+	char *buffer;
+	size_t size;
+	size_t capacity;
+};
+
+static void complete(struct Reduction *reduction,
+	struct Analytics *analytics);
+
+
+struct Analytics *createAnalytics(void)
+{
+	struct Analytics *analytics;
+	unsigned int i;
+
+	analytics = (struct Analytics *)mallocC(sizeof(struct Analytics));
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &analytics->ownId);
+	for (i = 0; i < PENDING; ++i)
+		analytics->reductions[i].active = false;
+	analytics->next = 0;
+
+	analytics->capacity = 1024 * MAX_LINE;
+	analytics->buffer = (char *)mallocC(analytics->capacity);
+	analytics->size = snprintf(analytics->buffer, analytics->capacity,
+		"#GEN\tPOPULATION\tBIRTHS\tDEATHS\tACTIVE_TILES"
+		"\tMIN_X\tMIN_Y\tMAX_X\tMAX_Y\n");
+
+	return analytics;
+}
+
+void freeAnalytics(struct Analytics *analytics)
+{
+	free(analytics->buffer);
+	free(analytics);
+}
+
+void addCensus(unsigned long long int generation, const struct Census *census,
+	struct Analytics *analytics)
+{
+	struct Reduction *reduction = &analytics->reductions[analytics->next];
+
+	if (reduction->active) complete(reduction, analytics);
+
+	reduction->active = true;
+	reduction->generation = generation;
+
+	reduction->sums[SUM_POPULATION] = census->population;
+	reduction->sums[SUM_BIRTHS] = census->births;
+	reduction->sums[SUM_DEATHS] = census->deaths;
+	reduction->sums[SUM_ACTIVE_TILES] = census->activeTiles;
+	reduction->bounds[BOUND_MIN_X] = census->minX;
+	reduction->bounds[BOUND_MIN_Y] = census->minY;
+	reduction->bounds[BOUND_MAX_X] = -census->maxX;
+	reduction->bounds[BOUND_MAX_Y] = -census->maxY;
+
+	MPI_Ireduce(reduction->sums, reduction->totalSums, NUM_SUMS,
+		MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD,
+		&reduction->requests[0]);
+	MPI_Ireduce(reduction->bounds, reduction->totalBounds, NUM_BOUNDS,
+		MPI_LONG, MPI_MIN, 0, MPI_COMM_WORLD, &reduction->requests[1]);
+
+	analytics->next = (analytics->next + 1) % PENDING;
+}
+
+/*
+ * Completes the reductions still in flight, in order, and writes the time
+ * series to 'analytics.data' from the first process
+ */
+bool saveAnalytics(struct Analytics *analytics)
+{
+	unsigned int i;
+	struct Reduction *reduction;
+
+	for (i = 0; i < PENDING; ++i) {
+		reduction = &analytics->reductions[
+			(analytics->next + i) % PENDING];
+		if (reduction->active) complete(reduction, analytics);
+	}
+
+	if (analytics->ownId != 0) return true;
+
+	return writeBuffer(analytics->buffer, analytics->size, "./",
+		"analytics.data", "w");
+}
+
+static void complete(struct Reduction *reduction,
+	struct Analytics *analytics)
+{
+	const unsigned long long int *sums = reduction->totalSums;
+	const long int *bounds = reduction->totalBounds;
+
+	MPI_Waitall(2, reduction->requests, MPI_STATUSES_IGNORE);
+	reduction->active = false;
+
+	if (analytics->ownId != 0) return;
+
+	if (analytics->capacity - analytics->size < MAX_LINE) {
+		analytics->capacity *= 2;
+		analytics->buffer = (char *)reallocC(analytics->buffer,
+			analytics->capacity);
+	}
+
+	// Without alive cells the box is printed as -1
+	analytics->size += snprintf(analytics->buffer + analytics->size,
+		analytics->capacity - analytics->size,
+		"%llu\t%llu\t%llu\t%llu\t%llu\t%ld\t%ld\t%ld\t%ld\n",
+		reduction->generation,
+		sums[SUM_POPULATION], sums[SUM_BIRTHS], sums[SUM_DEATHS],
+		sums[SUM_ACTIVE_TILES],
+		sums[SUM_POPULATION]? bounds[BOUND_MIN_X] : -1,
+		sums[SUM_POPULATION]? bounds[BOUND_MIN_Y] : -1,
+		-bounds[BOUND_MAX_X], -bounds[BOUND_MAX_Y]);
+}
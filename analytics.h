@@ -0,0 +1,15 @@
+#ifndef ANALYTICS_H_
+#define ANALYTICS_H_
+
+#include <stdbool.h>
+#include "world.h"
+
+struct Analytics;
+
+struct Analytics *createAnalytics(void);
+void freeAnalytics(struct Analytics *analytics);
+void addCensus(unsigned long long int generation, const struct Census *census,
+	struct Analytics *analytics);
+bool saveAnalytics(struct Analytics *analytics);
+
+#endif
@@ -0,0 +1,38 @@
+#include "barrier.h"
+#include <sched.h>
+
+// Spins before giving the CPU away, when there are more threads than CPUs
+#define SPIN_LIMIT 1024
+
+
+void initBarrier(unsigned int numThreads, struct Barrier *barrier)
+{
+	atomic_init(&barrier->count, numThreads);
+	atomic_init(&barrier->sense, false);
+	barrier->numThreads = numThreads;
+}
+
+/*
+ * The last thread to arrive resets the count and flips the shared sense, which
+ * releases the rest. Everything written before the barrier is visible after it.
+ */
+void barrier_wait(bool *sense, struct Barrier *barrier)
+{
+	unsigned int spins = 0;
+
+	*sense = !*sense;
+
+	if (atomic_fetch_sub_explicit(&barrier->count, 1,
+	    memory_order_acq_rel) == 1) {
+		atomic_store_explicit(&barrier->count, barrier->numThreads,
+			memory_order_relaxed);
+		atomic_store_explicit(&barrier->sense, *sense,
+			memory_order_release);
+		return;
+	}
+
+	while (atomic_load_explicit(&barrier->sense, memory_order_acquire) !=
+	       *sense) {
+		if (++spins >= SPIN_LIMIT) sched_yield();
+	}
+}
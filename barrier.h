@@ -0,0 +1,20 @@
+#ifndef BARRIER_H_
+#define BARRIER_H_
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ * Sense-reversing barrier for a team of threads that stays alive between
+ * generations. Each thread keeps its own sense, starting as false.
+ */
+struct Barrier {
+	atomic_uint count;
+	atomic_bool sense;
+	unsigned int numThreads;
+};
+
+void initBarrier(unsigned int numThreads, struct Barrier *barrier);
+void barrier_wait(bool *sense, struct Barrier *barrier);
+
+#endif
@@ -0,0 +1,487 @@
+#define _GNU_SOURCE
+#include "batch.h"
+#include "world.h"
+#include "gol.h"
+#include "dense.h"
+#include "ensemble.h"
+#include "stats.h"
+#include "io.h"
+#include "malloc.h"
+#include "affinity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include <mpi.h>
+
+// Longest rule accepted in a job, as "B12345678/S12345678"
+#define MAX_RULE 20
+// Room for a line of the results file, besides the rule
+#define MAX_LINE 256
+
+/*
+ * Each line of the job file is a world to simulate:
+ *   <x size>x<y size> <cells> <iterations> [<rule>] [<seed>]
+ * Empty lines and the ones starting with '#' are skipped. The rule is B3/S23
+ * and the seed the index of the job when they are not given.
+ */
+struct Job {
+	wsize_t x;
+	wsize_t y;
+	unsigned long long int cells;
+	unsigned long long int iterations;
+	char ruleName[MAX_RULE];
+	struct Rule rule;
+	unsigned int seed;
+};
+
+// Results of each job, set by the process that runs it and summed in the first
+enum Result {
+	RES_POPULATION,
+	RES_HASH,
+	RES_PROCESS,
+	NUM_RESULTS
+};
+
+struct Batch {
+	int ownId;
+	struct Job *jobs;
+	unsigned int numJobs;
+
+	// Jobs run together. With the ensemble engine, up to 64 jobs of the
+	// same size, iterations and rule, otherwise one job each.
+	struct Job **order;
+	unsigned int *groups;
+	unsigned int numGroups;
+
+	// Index of the next group, only exposed by the first process
+	MPI_Win queueWin;
+	long *queue;
+
+	unsigned long long int *results;
+	double *times;
+};
+
+static char *readJobFile(const char *fileName, int ownId);
+static bool parseJobs(char *buffer, struct Batch *batch);
+static void groupJobs(enum Engine engine, struct Batch *batch);
+static int compareJobs(const void *a, const void *b);
+static bool sameKind(const struct Job *jobA, const struct Job *jobB);
+static long nextGroup(struct Batch *batch);
+static void runJob(unsigned int indx, enum Engine engine,
+	unsigned int resort, struct Batch *batch);
+static void runEnsemble(struct Job **jobs, unsigned int numJobs,
+	struct Batch *batch);
+static void saveResults(double total, const struct Batch *batch);
+
+
+/*
+ * Runs the jobs of the file in every thread of every process. Each thread
+ * takes the next job from a counter kept by the first process, so the
+ * workers that get small worlds simply take more of them.
+ */
+bool runBatch(const struct Parameters *params)
+{
+	struct Batch batch;
+	char *buffer;
+	bool parsed;
+	double pTime;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &batch.ownId);
+
+	buffer = readJobFile(params->batch, batch.ownId);
+	if (buffer == NULL) {
+		if (batch.ownId == 0)
+			fprintf(stderr, "Can't read %s\n", params->batch);
+		return false;
+	}
+
+	parsed = parseJobs(buffer, &batch);
+	free(buffer);
+	if (!parsed) {
+		free(batch.jobs);
+		return false;
+	}
+
+	batch.results = (unsigned long long int *)mallocC(
+		batch.numJobs * NUM_RESULTS * sizeof(unsigned long long int));
+	batch.times = (double *)mallocC(batch.numJobs * sizeof(double));
+	memset(batch.results, 0,
+		batch.numJobs * NUM_RESULTS * sizeof(unsigned long long int));
+	memset(batch.times, 0, batch.numJobs * sizeof(double));
+
+	groupJobs(params->engine, &batch);
+
+	MPI_Win_allocate(batch.ownId? 0 : sizeof(long), sizeof(long),
+		MPI_INFO_NULL, MPI_COMM_WORLD, &batch.queue, &batch.queueWin);
+	if (batch.ownId == 0) {
+		MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, batch.queueWin);
+		*batch.queue = 0;
+		MPI_Win_unlock(0, batch.queueWin);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	// Each world runs in the thread that took it
+	omp_set_max_active_levels(1);
+
+	pTime = omp_get_wtime();
+	#pragma omp parallel num_threads(params->numThreads)
+	{
+		long group;
+		struct Job **jobs;
+		unsigned int numJobs;
+
+		pinThread();
+		while ((group = nextGroup(&batch)) < batch.numGroups) {
+			jobs = &batch.order[batch.groups[group]];
+			numJobs = batch.groups[group + 1] - batch.groups[group];
+
+			if (params->engine == ENGINE_ENSEMBLE)
+				runEnsemble(jobs, numJobs, &batch);
+			else
+				runJob(jobs[0] - batch.jobs, params->engine,
+					params->resort, &batch);
+		}
+	}
+
+	MPI_Reduce(batch.ownId? batch.results : MPI_IN_PLACE, batch.results,
+		batch.numJobs * NUM_RESULTS, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0,
+		MPI_COMM_WORLD);
+	MPI_Reduce(batch.ownId? batch.times : MPI_IN_PLACE, batch.times,
+		batch.numJobs, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	if (batch.ownId == 0)
+		saveResults(omp_get_wtime() - pTime, &batch);
+
+	MPI_Win_free(&batch.queueWin);
+	free(batch.order);
+	free(batch.groups);
+	free(batch.jobs);
+	free(batch.results);
+	free(batch.times);
+
+	return true;
+}
+
+/*
+ * The first process reads the file and sends it to the rest
+ */
+static char *readJobFile(const char *fileName, int ownId)
+{
+	FILE *file;
+	long size = -1;
+	char *buffer = NULL;
+
+	if (ownId == 0) {
+		file = fopen(fileName, "r");
+		if (file != NULL) {
+			fseek(file, 0, SEEK_END);
+			size = ftell(file);
+			rewind(file);
+
+			buffer = (char *)mallocC(size + 1);
+			if (fread(buffer, sizeof(char), size, file) != (size_t)size)
+				size = -1;
+			fclose(file);
+		}
+	}
+
+	MPI_Bcast(&size, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+	if (size < 0) {
+		free(buffer);
+		return NULL;
+	}
+
+	if (ownId != 0) buffer = (char *)mallocC(size + 1);
+	MPI_Bcast(buffer, size, MPI_CHAR, 0, MPI_COMM_WORLD);
+	buffer[size] = '\0';
+
+	return buffer;
+}
+
+static bool parseJobs(char *buffer, struct Batch *batch)
+{
+	char *line, *savePtr;
+	unsigned int maxJobs = 0;
+	unsigned int lineNum = 0;
+	struct Job *job;
+	long x, y;
+	int fields;
+
+	batch->jobs = NULL;
+	batch->numJobs = 0;
+
+	for (line = strtok_r(buffer, "\n", &savePtr); line != NULL;
+	     line = strtok_r(NULL, "\n", &savePtr))
+	{
+		++lineNum;
+		line += strspn(line, " \t");
+		if (*line == '\0' || *line == '#') continue;
+
+		if (batch->numJobs == maxJobs) {
+			maxJobs = maxJobs? 2 * maxJobs : 64;
+			batch->jobs = (struct Job *)reallocC(batch->jobs,
+				maxJobs * sizeof(struct Job));
+		}
+
+		job = &batch->jobs[batch->numJobs];
+		strcpy(job->ruleName, "B3/S23");
+		job->seed = batch->numJobs;
+
+		fields = sscanf(line, "%ldx%ld %llu %llu %19s %u", &x, &y,
+			&job->cells, &job->iterations, job->ruleName,
+			&job->seed);
+		job->x = x;
+		job->y = y;
+
+		if (fields < 4 || x <= 0 || y <= 0 || !worldFits(x, y) ||
+		    job->iterations == 0 ||
+		    !parseRule(job->ruleName, &job->rule))
+		{
+			if (batch->ownId == 0)
+				fprintf(stderr, "Wrong job at line %u\n", lineNum);
+			return false;
+		}
+
+		++(batch->numJobs);
+	}
+
+	if (batch->numJobs == 0 && batch->ownId == 0)
+		fprintf(stderr, "No jobs to run\n");
+
+	return batch->numJobs > 0;
+}
+
+/*
+ * Jobs of the same group are contiguous in 'order', starting at the index in
+ * 'groups'. There is an extra entry at the end of 'groups'.
+ */
+static void groupJobs(enum Engine engine, struct Batch *batch)
+{
+	unsigned int i;
+	unsigned int size = 0;
+
+	batch->order = (struct Job **)mallocC(
+		batch->numJobs * sizeof(struct Job *));
+	batch->groups = (unsigned int *)mallocC(
+		(batch->numJobs + 1) * sizeof(unsigned int));
+
+	for (i = 0; i < batch->numJobs; ++i)
+		batch->order[i] = &batch->jobs[i];
+
+	if (engine == ENGINE_ENSEMBLE) {
+		qsort(batch->order, batch->numJobs, sizeof(struct Job *),
+			compareJobs);
+	}
+
+	batch->numGroups = 0;
+	for (i = 0; i < batch->numJobs; ++i) {
+		if (engine != ENGINE_ENSEMBLE || size == ENSEMBLE_LANES ||
+		    i == 0 || !sameKind(batch->order[i-1], batch->order[i]))
+		{
+			batch->groups[batch->numGroups++] = i;
+			size = 0;
+		}
+		++size;
+	}
+	batch->groups[batch->numGroups] = batch->numJobs;
+}
+
+/*
+ * Orders by size, iterations and rule, and then by position in the file
+ */
+static int compareJobs(const void *a, const void *b)
+{
+	const struct Job *jobA = *(const struct Job **)a;
+	const struct Job *jobB = *(const struct Job **)b;
+
+	if (jobA->x != jobB->x) return jobA->x < jobB->x? -1 : 1;
+	if (jobA->y != jobB->y) return jobA->y < jobB->y? -1 : 1;
+	if (jobA->iterations != jobB->iterations)
+		return jobA->iterations < jobB->iterations? -1 : 1;
+	if (jobA->rule.birth != jobB->rule.birth)
+		return jobA->rule.birth < jobB->rule.birth? -1 : 1;
+	if (jobA->rule.survive != jobB->rule.survive)
+		return jobA->rule.survive < jobB->rule.survive? -1 : 1;
+
+	return jobA < jobB? -1 : 1;
+}
+
+// Jobs that can share an ensemble
+static bool sameKind(const struct Job *jobA, const struct Job *jobB)
+{
+	return jobA->x == jobB->x && jobA->y == jobB->y &&
+		jobA->iterations == jobB->iterations &&
+		jobA->rule.birth == jobB->rule.birth &&
+		jobA->rule.survive == jobB->rule.survive;
+}
+
+static long nextGroup(struct Batch *batch)
+{
+	const long one = 1;
+	long group;
+
+	// Only a thread at a time may call MPI
+	#pragma omp critical(batchQueue)
+	{
+		MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, batch->queueWin);
+		MPI_Fetch_and_op(&one, &group, MPI_LONG, 0, 0, MPI_SUM,
+			batch->queueWin);
+		MPI_Win_unlock(0, batch->queueWin);
+	}
+
+	return group;
+}
+
+/*
+ * Simulates a whole world in the calling thread, without limits
+ */
+static void runJob(unsigned int indx, enum Engine engine,
+	unsigned int resort, struct Batch *batch)
+{
+	const struct Job *job = &batch->jobs[indx];
+	unsigned long long int *result = &batch->results[indx * NUM_RESULTS];
+	unsigned int seed = job->seed;
+	struct Stats *stats;
+	struct World *world = NULL;
+	struct GOL *gol = NULL;
+	struct Dense *dense = NULL;
+	unsigned long long int i;
+	wsize_t x, y;
+	double jobTime;
+
+	jobTime = omp_get_wtime();
+
+	stats = createStats(job->iterations, 1);
+	if (engine == ENGINE_DENSE) {
+		dense = createDense(job->x, job->y, 0, 1, 1, &job->rule, stats);
+		setDenseHashing(true, dense);
+	} else {
+		world = createWorld(job->x, job->y, 0);
+		gol = golInit(1, &job->rule, world, stats);
+		setResortPeriod(resort, gol);
+	}
+
+	for (i = 0; i < job->cells; ++i) {
+		x = rand_r(&seed) % job->x;
+		y = rand_r(&seed) % job->y;
+
+		if (dense)
+			dense_reviveCell(x, y, dense);
+		else
+			gol_reviveCell(x, y, gol);
+	}
+
+	for (i = 0; i <= job->iterations; ++i) {
+		if (dense)
+			dense_iteration(dense, NULL);
+		else
+			iteration(gol, NULL);
+	}
+
+	if (dense) {
+		result[RES_POPULATION] = dense_getPopulation(dense);
+		result[RES_HASH] = getDenseHash(dense);
+		destroyDense(dense);
+	} else {
+		result[RES_POPULATION] = getPopulation(world);
+		result[RES_HASH] = getWorldHash(world);
+		golEnd(gol);
+		destroyWorld(world);
+	}
+	result[RES_PROCESS] = batch->ownId;
+	freeStats(stats);
+
+	batch->times[indx] = omp_get_wtime() - jobTime;
+}
+
+/*
+ * Simulates the jobs of a group at once, each in a bit of the ensemble. Each
+ * world is seeded as runJob() does, so both give the same results.
+ */
+static void runEnsemble(struct Job **jobs, unsigned int numJobs,
+	struct Batch *batch)
+{
+	const struct Job *job = jobs[0];
+	struct Ensemble *ensemble;
+	unsigned long long int populations[ENSEMBLE_LANES];
+	uint64_t hashes[ENSEMBLE_LANES];
+	unsigned long long int *result;
+	unsigned long long int i;
+	unsigned int lane, indx;
+	unsigned int seed;
+	wsize_t x, y;
+	double jobTime;
+
+	jobTime = omp_get_wtime();
+
+	ensemble = createEnsemble(job->x, job->y, &job->rule);
+
+	for (lane = 0; lane < numJobs; ++lane) {
+		seed = jobs[lane]->seed;
+		for (i = 0; i < jobs[lane]->cells; ++i) {
+			x = rand_r(&seed) % job->x;
+			y = rand_r(&seed) % job->y;
+			ensemble_reviveCell(x, y, lane, ensemble);
+		}
+	}
+
+	for (i = 0; i <= job->iterations; ++i)
+		ensemble_iteration(ensemble);
+
+	ensemble_getPopulations(populations, ensemble);
+	ensemble_getHashes(hashes, ensemble);
+	destroyEnsemble(ensemble);
+
+	// The time is shared by all the worlds
+	jobTime = (omp_get_wtime() - jobTime) / numJobs;
+
+	for (lane = 0; lane < numJobs; ++lane) {
+		indx = jobs[lane] - batch->jobs;
+		result = &batch->results[indx * NUM_RESULTS];
+
+		result[RES_POPULATION] = populations[lane];
+		result[RES_HASH] = hashes[lane];
+		result[RES_PROCESS] = batch->ownId;
+		batch->times[indx] = jobTime;
+	}
+}
+
+/*
+ * A line per job in 'batch.data', in the order of the job file
+ */
+static void saveResults(double total, const struct Batch *batch)
+{
+	const unsigned long long int *result;
+	const struct Job *job;
+	char *buffer;
+	size_t maxBuffSize;
+	int written;
+	unsigned int i;
+
+	maxBuffSize = (batch->numJobs + 2) * (MAX_LINE + MAX_RULE);
+	buffer = (char *)mallocC(maxBuffSize * sizeof(char));
+
+	written = snprintf(buffer, maxBuffSize,
+		"#JOB\tSIZE\tCELLS\tITERATIONS\tRULE\tSEED\tPOPULATION\tHASH"
+		"\tTIME\tPROCESS\n");
+
+	for (i = 0; i < batch->numJobs; ++i) {
+		job = &batch->jobs[i];
+		result = &batch->results[i * NUM_RESULTS];
+
+		written += snprintf(buffer + written, maxBuffSize - written,
+			"%u\t%ldx%ld\t%llu\t%llu\t%s\t%u\t%llu\t%016llx\t%.10e"
+			"\t%llu\n",
+			i, (long int)job->x, (long int)job->y, job->cells,
+			job->iterations, job->ruleName, job->seed,
+			result[RES_POPULATION], result[RES_HASH],
+			batch->times[i], result[RES_PROCESS]);
+	}
+
+	written += snprintf(buffer + written, maxBuffSize - written,
+		"#TOTAL\t%.10e\n", total);
+
+	writeBuffer(buffer, written, "./", "batch.data", "w");
+	free(buffer);
+}
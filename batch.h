@@ -0,0 +1,9 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <stdbool.h>
+#include "node.h"
+
+bool runBatch(const struct Parameters *params);
+
+#endif
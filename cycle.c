@@ -0,0 +1,50 @@
+#include "cycle.h"
+#include "malloc.h"
+#include <stdlib.h>
+
+struct CycleDetector {
+	uint64_t hashes[CYCLE_MAX_PERIOD];
+	unsigned int last;
+	unsigned int stored;
+};
+
+struct CycleDetector *createCycleDetector()
+{
+	struct CycleDetector *detector;
+
+	detector = (struct CycleDetector *)
+		mallocC(sizeof(struct CycleDetector));
+	detector->last = 0;
+	detector->stored = 0;
+
+	return detector;
+}
+
+void freeCycleDetector(struct CycleDetector *detector)
+{
+	free(detector);
+}
+
+/*
+ * Stores the hash of the current generation and returns the period of the
+ * cycle it closes, or 0 if it has not been seen in the last CYCLE_MAX_PERIOD
+ * generations
+ */
+unsigned int checkCycle(uint64_t hash, struct CycleDetector *detector)
+{
+	unsigned int period;
+	unsigned int indx;
+
+	for (period = 1; period <= detector->stored; ++period) {
+		indx = (detector->last + CYCLE_MAX_PERIOD - period + 1)
+			% CYCLE_MAX_PERIOD;
+		if (detector->hashes[indx] == hash)
+			return period;
+	}
+
+	detector->last = (detector->last + 1) % CYCLE_MAX_PERIOD;
+	detector->hashes[detector->last] = hash;
+	if (detector->stored < CYCLE_MAX_PERIOD) ++(detector->stored);
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef CYCLE_H_
+#define CYCLE_H_
+
+#include <stdint.h>
+#include "world.h"
+
+// Longest period that can be detected
+#define CYCLE_MAX_PERIOD 1024
+
+enum CycleAction {
+	CYCLE_OFF,
+	CYCLE_STOP,
+	CYCLE_SKIP
+};
+
+struct CycleDetector;
+
+/*
+ * Zobrist key of the cell at the global coordinates. Keys are derived with the
+ * splitmix64 finalizer instead of being stored in a table, so the hash of the
+ * whole world is the XOR of the hashes of all nodes.
+ */
+inline static uint64_t zobristKey(wsize_t x, wsize_t y)
+{
+	uint64_t key;
+
+	key = ((uint64_t)x << 32) ^ (uint64_t)y;
+	key += 0x9e3779b97f4a7c15ULL;
+	key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+
+	return key ^ (key >> 31);
+}
+
+struct CycleDetector *createCycleDetector(void);
+void freeCycleDetector(struct CycleDetector *detector);
+unsigned int checkCycle(uint64_t hash, struct CycleDetector *detector);
+
+#endif
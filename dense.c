@@ -0,0 +1,790 @@
+#include "dense.h"
+#include "cycle.h"
+#include "malloc.h"
+#include "pages.h"
+#include "density.h"
+#include "steal.h"
+#include "affinity.h"
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+// Rows of each block shared between threads
+#define ROW_BLOCK 16
+// Columns processed at once, so the three rows involved stay in cache
+#define COL_BLOCK 4096
+// Cells of each word whose changes are tracked, COL_BLOCK is a multiple
+#define DIRTY_WORD 64
+// Below this fraction of skipped words tracking costs more than it saves, and
+// it is stopped for some generations
+#define MIN_SKIPPED 0.5
+#define UNTRACKED_GENERATIONS 16
+
+/*
+ * The world is stored twice as an array of one byte per cell, with ghost rows
+ * and a ghost column at each side. Each generation reads the current buffer
+ * and writes the next one, then both are swapped.
+ *
+ * With limits there are 'halo' ghost rows at each side, received every 'halo'
+ * generations. Meanwhile the valid ghost rows shrink by one each generation,
+ * as the rows next to them are computed redundantly.
+ *
+ * A bitmap keeps which words of DIRTY_WORD cells of each row changed in the
+ * last generation. A word whose neighbor words didn't change keeps its state,
+ * which the next buffer already holds from the generation before, so it is
+ * skipped. The rows next to the limits depend on the ghost rows and are
+ * always computed.
+ */
+struct Dense {
+	wsize_t x;
+	wsize_t y;
+	wsize_t stride;
+	unsigned char limits;
+	wsize_t halo;
+	wsize_t haloLeft;
+
+	unsigned char *buffers[2];
+	unsigned char *cur;
+	unsigned char *next;
+
+	unsigned char table[2*9];
+	wsize_t (*stepBlock)(wsize_t firstRow, wsize_t lastRow, bool hashing,
+		uint64_t *hash, const struct Dense *dense);
+	unsigned int numThreads;
+	struct Steal *steal;
+
+	// Generation being stepped: the rows from interiorFirst to interiorLast
+	// are shared by the team, the ones around are left to the master thread
+	const struct Exchange *exchange;
+	wsize_t extra;
+	wsize_t interiorFirst, interiorLast;
+	uint64_t stepHash;
+	wsize_t stepSkipped;
+	double ccTime;
+
+	// Changed words and rows of the last generation, read, and of this one,
+	// written while marking. Until allDirty is cleared every word is
+	// computed.
+	uint64_t *changed[2];
+	unsigned char *dirtyRows[2];
+	unsigned int curChanged;
+	wsize_t numWords;
+	wsize_t changedStride;
+	bool allDirty;
+	bool marking;
+	unsigned int untracked;
+	struct Stats *stats;
+
+	wsize_t xOffset;
+	bool hashing;
+	uint64_t hash;
+};
+
+static void setCell(wsize_t x, wsize_t y, unsigned char alive,
+	struct Dense *dense);
+static wsize_t stepLimits(uint64_t *hash, struct Dense *dense);
+static wsize_t stepRows(wsize_t firstRow, wsize_t lastRow, uint64_t *hash,
+	struct Dense *dense);
+static void fillColumns(wsize_t first, wsize_t last, struct Dense *dense);
+static wsize_t stepBlock(wsize_t firstRow, wsize_t lastRow, bool hashing,
+	uint64_t *hash, bool fixed, unsigned int birth, unsigned int survive,
+	const struct Dense *dense);
+static wsize_t stepBlock_generic(wsize_t firstRow, wsize_t lastRow,
+	bool hashing, uint64_t *hash, const struct Dense *dense);
+static bool isWordNeeded(wsize_t x, wsize_t word, const struct Dense *dense);
+static void markChanges(wsize_t firstCol, wsize_t lastCol,
+	const unsigned char *mid, const unsigned char *out, uint64_t *changed,
+	unsigned char *dirtyRow);
+
+/*
+ * Instantiates stepBlock for a fixed rule. The next state is computed with
+ * comparisons instead of the table, so the inner loop can be vectorized.
+ */
+#define DEFINE_STEP_BLOCK(name, birth, survive)				\
+	static wsize_t stepBlock_##name(wsize_t firstRow, wsize_t lastRow,\
+		bool hashing, uint64_t *hash, const struct Dense *dense)	\
+	{								\
+		if (hashing)						\
+			return stepBlock(firstRow, lastRow, true, hash,	\
+				true, birth, survive, dense);		\
+		else							\
+			return stepBlock(firstRow, lastRow, false, hash,	\
+				true, birth, survive, dense);		\
+	}
+
+DEFINE_STEP_BLOCK(B3S23, RULE_3, RULE_2 | RULE_3)
+DEFINE_STEP_BLOCK(B36S23, RULE_3 | RULE_6, RULE_2 | RULE_3)
+DEFINE_STEP_BLOCK(B3678S34678, RULE_3 | RULE_6 | RULE_7 | RULE_8,
+	RULE_3 | RULE_4 | RULE_6 | RULE_7 | RULE_8)
+DEFINE_STEP_BLOCK(B2S, RULE_2, 0)
+
+// Specialized kernels, any other rule uses the table
+static const struct Kernel {
+	struct Rule rule;
+	wsize_t (*stepBlock)(wsize_t firstRow, wsize_t lastRow, bool hashing,
+		uint64_t *hash, const struct Dense *dense);
+} kernels[] = {
+	{{RULE_3, RULE_2 | RULE_3}, stepBlock_B3S23},
+	{{RULE_3 | RULE_6, RULE_2 | RULE_3}, stepBlock_B36S23},
+	{{RULE_3 | RULE_6 | RULE_7 | RULE_8,
+	  RULE_3 | RULE_4 | RULE_6 | RULE_7 | RULE_8}, stepBlock_B3678S34678},
+	{{RULE_2, 0}, stepBlock_B2S}
+};
+
+
+struct Dense *createDense(wsize_t x, wsize_t y, unsigned char limits,
+	wsize_t halo, unsigned int numThreads, const struct Rule *rule,
+	struct Stats *stats)
+{
+	struct Dense *dense;
+	size_t bufferSize;
+	size_t ghostSize;
+	wsize_t block;
+	wsize_t numBlocks;
+	unsigned int i;
+	int n;
+
+	dense = (struct Dense *)mallocC(sizeof(struct Dense));
+
+	dense->x = x;
+	dense->y = y;
+	dense->stride = y + 2;
+	dense->limits = limits;
+	dense->halo = limits? halo : 1;
+	dense->haloLeft = 0;
+	dense->numThreads = numThreads;
+	dense->steal = createSteal(numThreads);
+	dense->stats = stats;
+	stats->skippedWords = 0.0;
+	dense->xOffset = 0;
+	dense->hashing = false;
+	dense->hash = 0;
+	dense->exchange = NULL;
+
+	omp_set_num_threads(numThreads);
+
+	// Allocate memory
+	bufferSize = (size_t)(x + 2*dense->halo) * dense->stride;
+	ghostSize = (size_t)dense->halo * dense->stride;
+	dense->buffers[0] = (unsigned char *)mallocLarge(bufferSize);
+	dense->buffers[1] = (unsigned char *)mallocLarge(bufferSize);
+
+	// First touch each block of rows from the thread that will process it, so
+	// its pages are placed in the memory of that thread
+	numBlocks = (x + ROW_BLOCK - 1) / ROW_BLOCK;
+	#pragma omp parallel for schedule(static)
+	for (block = 0; block < numBlocks; ++block) {
+		wsize_t firstRow = block * ROW_BLOCK;
+		wsize_t numRows = x - firstRow < ROW_BLOCK?
+			x - firstRow : ROW_BLOCK;
+		size_t offset = ghostSize + (size_t)firstRow * dense->stride;
+
+		memset(dense->buffers[0] + offset, 0, (size_t)numRows * dense->stride);
+		memset(dense->buffers[1] + offset, 0, (size_t)numRows * dense->stride);
+	}
+	memset(dense->buffers[0], 0, ghostSize);
+	memset(dense->buffers[1], 0, ghostSize);
+	memset(dense->buffers[0] + bufferSize - ghostSize, 0, ghostSize);
+	memset(dense->buffers[1] + bufferSize - ghostSize, 0, ghostSize);
+
+	dense->numWords = (y + DIRTY_WORD - 1) / DIRTY_WORD;
+	dense->changedStride = (dense->numWords + 63) / 64;
+	for (i = 0; i < 2; ++i) {
+		dense->changed[i] = (uint64_t *)mallocC(
+			(size_t)x * dense->changedStride * sizeof(uint64_t));
+		dense->dirtyRows[i] = (unsigned char *)mallocC(x);
+	}
+	dense->curChanged = 0;
+	dense->allDirty = true;
+	dense->marking = true;
+	dense->untracked = 0;
+
+	// Point to the first cell, after the ghost rows and column
+	dense->cur  = dense->buffers[0] + ghostSize + 1;
+	dense->next = dense->buffers[1] + ghostSize + 1;
+
+	// Next state indexed by current state and alive neighbors
+	dense->table[0] = dense->table[9] = 0;
+	for (n = 1; n <= 8; ++n) {
+		dense->table[n]     = (rule->birth   >> (n-1)) & 1;
+		dense->table[9 + n] = (rule->survive >> (n-1)) & 1;
+	}
+
+	dense->stepBlock = stepBlock_generic;
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+		if (kernels[i].rule.birth == rule->birth &&
+		    kernels[i].rule.survive == rule->survive)
+			dense->stepBlock = kernels[i].stepBlock;
+	}
+
+	return dense;
+}
+
+void destroyDense(struct Dense *dense)
+{
+	freeLarge(dense->buffers[0]);
+	freeLarge(dense->buffers[1]);
+	free(dense->changed[0]);
+	free(dense->changed[1]);
+	free(dense->dirtyRows[0]);
+	free(dense->dirtyRows[1]);
+	freeSteal(dense->steal);
+	free(dense);
+}
+
+inline void dense_getSize(wsize_t *x, wsize_t *y, const struct Dense *dense)
+{
+	*x = dense->x;
+	*y = dense->y;
+}
+
+inline wsize_t dense_getHalo(const struct Dense *dense)
+{
+	return dense->halo;
+}
+
+inline bool dense_haloExpired(const struct Dense *dense)
+{
+	return dense->limits && dense->haloLeft == 0;
+}
+
+inline void setDenseOffset(wsize_t xOffset, struct Dense *dense)
+{
+	dense->xOffset = xOffset;
+}
+
+inline void setDenseHashing(bool hashing, struct Dense *dense)
+{
+	dense->hashing = hashing;
+}
+
+inline uint64_t getDenseHash(const struct Dense *dense)
+{
+	return dense->hash;
+}
+
+void dense_reviveCell(wsize_t x, wsize_t y, struct Dense *dense)
+{
+	setCell(x, y, 1, dense);
+}
+
+void dense_killCell(wsize_t x, wsize_t y, struct Dense *dense)
+{
+	setCell(x, y, 0, dense);
+}
+
+inline static void setCell(wsize_t x, wsize_t y, unsigned char alive,
+	struct Dense *dense)
+{
+	unsigned char *cell;
+
+	// Seeding coordinates may lie several worlds away
+	x %= dense->x;
+	y %= dense->y;
+	if (x < 0) x += dense->x;
+	if (y < 0) y += dense->y;
+
+	cell = &dense->cur[(windex_t)x*dense->stride + y];
+	if (*cell != alive) {
+		*cell = alive;
+		dense->hash ^= zobristKey(x + dense->xOffset, y);
+		dense->allDirty = true;
+	}
+}
+
+inline bool dense_isCellAlive(wsize_t x, wsize_t y, const struct Dense *dense)
+{
+	return dense->cur[(windex_t)x*dense->stride + y];
+}
+
+unsigned long long int dense_getPopulation(const struct Dense *dense)
+{
+	unsigned long long int population = 0;
+	wsize_t i, j;
+
+	for (i = 0; i < dense->x; ++i) {
+		for (j = 0; j < dense->y; ++j)
+			population += dense->cur[(windex_t)i*dense->stride + j];
+	}
+
+	return population;
+}
+
+/*
+ * Each thread adds its rows to a row of counts, and then to the map, so the
+ * rows of the same block can be added in parallel
+ */
+void dense_addDensity(struct DensityMap *map, const struct Dense *dense)
+{
+	#pragma omp parallel
+	{
+		unsigned int *rowCounts;
+		unsigned int *pixels;
+		const unsigned char *row;
+		wsize_t i, j;
+
+		rowCounts = (unsigned int *)mallocC(
+			map->cols * sizeof(unsigned int));
+
+		#pragma omp for schedule(static)
+		for (i = 0; i < dense->x; ++i) {
+			memset(rowCounts, 0, map->cols * sizeof(unsigned int));
+
+			row = &dense->cur[(windex_t)i*dense->stride];
+			for (j = 0; j < dense->y; ++j)
+				rowCounts[map->colBlock[j]] += row[j];
+
+			pixels = &map->counts[map->rowBlock[i] * map->cols];
+			for (j = 0; j < map->cols; ++j) {
+				if (rowCounts[j]) {
+					#pragma omp atomic
+					pixels[j] += rowCounts[j];
+				}
+			}
+		}
+
+		free(rowCounts);
+	}
+}
+
+/*
+ * Packs the cells inside the rows and columns of 'packed', eight per byte
+ */
+void dense_packWorld(struct PackedRows *packed, const struct Dense *dense)
+{
+	wsize_t i;
+
+	#pragma omp parallel for schedule(static)
+	for (i = packed->x0; i < packed->x1; ++i) {
+		const unsigned char *row = &dense->cur[(windex_t)i*dense->stride];
+		unsigned char *bytes = &packed->rows[
+			(i - packed->x0) * packed->rowBytes];
+		wsize_t j;
+
+		for (j = packed->y0; j < packed->y1; ++j)
+			bytes[(j - packed->y0) / 8] |=
+				row[j] << ((j - packed->y0) % 8);
+	}
+}
+
+/*
+ * Sets the cells of the rows and columns of 'packed' to its bits
+ */
+void dense_unpackWorld(const struct PackedRows *packed, struct Dense *dense)
+{
+	wsize_t i;
+	uint64_t hash = 0;
+
+	#pragma omp parallel for schedule(static) reduction(^:hash)
+	for (i = packed->x0; i < packed->x1; ++i) {
+		unsigned char *row = &dense->cur[(windex_t)i*dense->stride];
+		const unsigned char *bytes = &packed->rows[
+			(i - packed->x0) * packed->rowBytes];
+		unsigned char alive;
+		wsize_t j;
+
+		for (j = packed->y0; j < packed->y1; ++j) {
+			alive = (bytes[(j - packed->y0) / 8] >>
+				((j - packed->y0) % 8)) & 1;
+			if (dense->hashing && row[j] != alive)
+				hash ^= zobristKey(i + dense->xOffset, j);
+			row[j] = alive;
+		}
+	}
+
+	dense->hash ^= hash;
+	dense->allDirty = true;
+}
+
+/*
+ * Row of the current generation. The ghost rows -halo..-1 and x..x+halo-1 can
+ * be written to receive the neighbor rows when the world has limits.
+ */
+inline unsigned char *dense_getRow(wsize_t x, struct Dense *dense)
+{
+	return &dense->cur[(windex_t)x*dense->stride];
+}
+
+/*
+ * Storage of the 'halo' rows starting at x, ghost columns included, so they
+ * can be exchanged as a single block
+ */
+inline unsigned char *dense_getHaloRows(wsize_t x, size_t *size,
+	struct Dense *dense)
+{
+	*size = (size_t)dense->halo * dense->stride;
+	return &dense->cur[(windex_t)x*dense->stride - 1];
+}
+
+/*
+ * Steps a generation with a team of threads, exchanging the ghost rows when
+ * they expired
+ */
+void dense_iteration(struct Dense *dense, const struct Exchange *exchange)
+{
+	dense_prepare(dense, exchange);
+
+	#pragma omp parallel
+	dense_step(dense);
+
+	dense_finish(dense);
+}
+
+/*
+ * Fills the ghost cells that can be filled before the team starts, and splits
+ * the interior rows between the threads. Called by a single thread.
+ */
+void dense_prepare(struct Dense *dense, const struct Exchange *exchange)
+{
+	wsize_t numBlocks;
+	double wupTime;
+
+	wupTime = startMeasurement();
+
+	dense->exchange = NULL;
+	if (dense_haloExpired(dense)) {
+		dense->exchange = exchange;
+		dense->haloLeft = dense->halo;
+	}
+
+	// Rows computed beyond each limit, to be valid in the next generations
+	dense->extra = dense->limits? dense->haloLeft - 1 : 0;
+
+	dense->marking = dense->untracked == 0;
+	if (!dense->marking) --(dense->untracked);
+
+	// With limits, the rows next to them read the ghost rows, so they are
+	// left to the master thread, which receives them
+	if (dense->limits) {
+		fillColumns(0, dense->x - 1, dense);
+		if (!dense->exchange) {
+			fillColumns(-dense->extra - 1, -1, dense);
+			fillColumns(dense->x, dense->x + dense->extra, dense);
+		}
+		dense->interiorFirst = 1;
+		dense->interiorLast = dense->x > 1? dense->x - 1 : 1;
+	} else {
+		memcpy(dense_getRow(-1, dense), dense_getRow(dense->x-1, dense),
+			dense->y);
+		memcpy(dense_getRow(dense->x, dense), dense_getRow(0, dense),
+			dense->y);
+		fillColumns(-1, dense->x, dense);
+		dense->interiorFirst = 0;
+		dense->interiorLast = dense->x;
+	}
+
+	endMeasurement(wupTime, worldUpdate, dense->stats);
+
+	dense->stepHash = 0;
+	dense->stepSkipped = 0;
+	numBlocks = (dense->interiorLast - dense->interiorFirst + ROW_BLOCK -
+		1) / ROW_BLOCK;
+
+	dense->ccTime = startMeasurement();
+	steal_reset(0, numBlocks, 1, dense->steal);
+}
+
+/*
+ * Steps the rows, called by every thread of the team. Only the master thread
+ * communicates, so MPI_THREAD_FUNNELED is enough.
+ */
+void dense_step(struct Dense *dense)
+{
+	unsigned int firstBlock, lastBlock;
+	wsize_t firstRow, lastRow;
+	uint64_t hash = 0;
+	wsize_t skipped = 0;
+
+	pinThread();
+
+	#pragma omp master
+	if (dense->limits) skipped += stepLimits(&hash, dense);
+
+	while (steal_next(&firstBlock, &lastBlock, dense->steal)) {
+		firstRow = dense->interiorFirst + (wsize_t)firstBlock * ROW_BLOCK;
+		lastRow = dense->interiorFirst + (wsize_t)lastBlock * ROW_BLOCK;
+		if (lastRow > dense->interiorLast) lastRow = dense->interiorLast;
+
+		skipped += stepRows(firstRow, lastRow, &hash, dense);
+	}
+
+	#pragma omp atomic
+	dense->stepHash ^= hash;
+	#pragma omp atomic
+	dense->stepSkipped += skipped;
+}
+
+/*
+ * Swaps the buffers once every thread is done. Called by a single thread.
+ */
+void dense_finish(struct Dense *dense)
+{
+	unsigned char *tmp;
+	double wupTime;
+	double skippedRatio;
+
+	steal_addStats(dense->stats, dense->steal);
+	endMeasurement(dense->ccTime, cellChecking, dense->stats);
+
+	wupTime = startMeasurement();
+	dense->hash ^= dense->stepHash;
+
+	tmp = dense->cur;
+	dense->cur = dense->next;
+	dense->next = tmp;
+	dense->curChanged ^= 1;
+	if (dense->limits) --(dense->haloLeft);
+
+	// Only the generations that read the bitmaps measure the skipped words
+	skippedRatio = dense->stepSkipped / ((double)dense->x * dense->numWords);
+	if (!dense->allDirty && skippedRatio < MIN_SKIPPED)
+		dense->untracked = UNTRACKED_GENERATIONS;
+	dense->allDirty = !dense->marking || dense->untracked > 0;
+	endMeasurement(wupTime, worldUpdate, dense->stats);
+
+	dense->stats->skippedWords += dense->stats->avgFactor * skippedRatio;
+}
+
+/*
+ * Steps the rows that read the ghost rows. When they expired, the rows are
+ * sent and each side is stepped once its ghost rows are received.
+ */
+static wsize_t stepLimits(uint64_t *hash, struct Dense *dense)
+{
+	const struct Exchange *exchange = dense->exchange;
+	wsize_t skipped = 0;
+
+	if (exchange) {
+		exchange->send(exchange->data);
+		exchange->receive(WB_TOP, exchange->data);
+		fillColumns(-dense->extra - 1, -1, dense);
+
+		// A single row also reads the bottom ghost rows
+		if (dense->x < 2) {
+			exchange->receive(WB_BOTTOM, exchange->data);
+			fillColumns(dense->x, dense->x + dense->extra, dense);
+		}
+	}
+	skipped += stepRows(-dense->extra, 1, hash, dense);
+
+	if (exchange && dense->x >= 2) {
+		exchange->receive(WB_BOTTOM, exchange->data);
+		fillColumns(dense->x, dense->x + dense->extra, dense);
+	}
+	skipped += stepRows(dense->interiorLast, dense->x + dense->extra, hash,
+		dense);
+
+	return skipped;
+}
+
+/*
+ * Steps the rows from first to last, excluded, in blocks. Returns the words
+ * skipped.
+ */
+static wsize_t stepRows(wsize_t firstRow, wsize_t lastRow, uint64_t *hash,
+	struct Dense *dense)
+{
+	wsize_t i, last;
+	wsize_t skipped = 0;
+	double thTime;
+
+	thTime = startMeasurement();
+
+	for (i = firstRow; i < lastRow; i += ROW_BLOCK) {
+		last = i + ROW_BLOCK < lastRow? i + ROW_BLOCK : lastRow;
+		skipped += dense->stepBlock(i, last, dense->hashing, hash,
+			dense);
+	}
+
+	endMeasurement(thTime, threads[omp_get_thread_num()], dense->stats);
+
+	return skipped;
+}
+
+/*
+ * Copies the opposite edges of the rows from first to last, both included,
+ * into their ghost columns
+ */
+static void fillColumns(wsize_t first, wsize_t last, struct Dense *dense)
+{
+	wsize_t i;
+	unsigned char *row;
+
+	for (i = first; i <= last; ++i) {
+		row = dense_getRow(i, dense);
+		row[-1] = row[dense->y-1];
+		row[dense->y] = row[0];
+	}
+}
+
+/*
+ * With a fixed rule, bit n of each mask is set when it applies with n alive
+ * neighbors. Otherwise the table of the world is used. Returns the words
+ * skipped. It must be inlined into each kernel for the rule to be constant.
+ */
+__attribute__((always_inline))
+inline static wsize_t stepBlock(wsize_t firstRow, wsize_t lastRow,
+	bool hashing, uint64_t *hash, bool fixed, unsigned int birth,
+	unsigned int survive, const struct Dense *dense)
+{
+	wsize_t i, j, word, firstWord, lastWord;
+	wsize_t firstCol, lastCol, runFirst, runLast;
+	const unsigned char *up, *mid, *down;
+	unsigned char *out;
+	unsigned char count;
+	unsigned char born, lives;
+	uint64_t *changed = NULL;
+	unsigned char *dirtyRow = NULL;
+	bool owned, tracked, marked, rowHashing;
+	wsize_t skipped = 0;
+	int n;
+
+	for (firstCol = 0; firstCol < dense->y; firstCol += COL_BLOCK) {
+		lastCol = firstCol + COL_BLOCK;
+		if (lastCol > dense->y) lastCol = dense->y;
+		firstWord = firstCol / DIRTY_WORD;
+		lastWord = (lastCol + DIRTY_WORD - 1) / DIRTY_WORD;
+
+		for (i = firstRow; i < lastRow; ++i) {
+			mid = &dense->cur[(windex_t)i*dense->stride];
+			up = mid - dense->stride;
+			down = mid + dense->stride;
+			out = &dense->next[(windex_t)i*dense->stride];
+
+			// Redundant rows belong to the neighbors, and the ones
+			// next to the limits read the ghost rows
+			owned = i >= 0 && i < dense->x;
+			tracked = owned && !dense->allDirty &&
+				(!dense->limits || (i > 0 && i < dense->x - 1));
+			marked = owned && dense->marking;
+			rowHashing = hashing && owned;
+
+			if (marked) {
+				changed = dense->changed[dense->curChanged ^ 1] +
+					(windex_t)i*dense->changedStride;
+				dirtyRow = dense->dirtyRows[dense->curChanged ^ 1] + i;
+				if (firstCol == 0) {
+					memset(changed, 0, dense->changedStride *
+						sizeof(uint64_t));
+					*dirtyRow = 0;
+				}
+			}
+
+			// Runs of words that may change
+			word = firstWord;
+			while (word < lastWord) {
+				if (tracked && !isWordNeeded(i, word, dense)) {
+					++skipped;
+					++word;
+					continue;
+				}
+
+				runFirst = word * DIRTY_WORD;
+				do {
+					++word;
+				} while (word < lastWord && (!tracked ||
+					isWordNeeded(i, word, dense)));
+				runLast = word * DIRTY_WORD;
+				if (runLast > lastCol) runLast = lastCol;
+
+				for (j = runFirst; j < runLast; ++j) {
+					count = up[j-1]   + up[j]   + up[j+1] +
+						mid[j-1]  +           mid[j+1] +
+						down[j-1] + down[j] + down[j+1];
+					if (fixed) {
+						born = lives = 0;
+						for (n = 1; n <= 8; ++n) {
+							born |= ((birth >> (n-1)) & 1) &
+								(count == n);
+							lives |= ((survive >> (n-1)) & 1) &
+								(count == n);
+						}
+						out[j] = mid[j]? lives : born;
+					} else {
+						out[j] = dense->table[mid[j]*9 + count];
+					}
+
+					if (rowHashing && out[j] != mid[j]) {
+						*hash ^= zobristKey(
+							i + dense->xOffset, j);
+					}
+				}
+
+				if (marked) {
+					markChanges(runFirst, runLast, mid, out,
+						changed, dirtyRow);
+				}
+			}
+		}
+	}
+
+	return skipped;
+}
+
+// Specialized without hashing, so it can be vectorized
+static wsize_t stepBlock_generic(wsize_t firstRow, wsize_t lastRow,
+	bool hashing, uint64_t *hash, const struct Dense *dense)
+{
+	if (hashing)
+		return stepBlock(firstRow, lastRow, true, hash, false, 0, 0,
+			dense);
+	else
+		return stepBlock(firstRow, lastRow, false, hash, false, 0, 0,
+			dense);
+}
+
+/*
+ * Whether any word around changed in the last generation. The rows and the
+ * words wrap around, as the cells do.
+ */
+inline static bool isWordNeeded(wsize_t x, wsize_t word,
+	const struct Dense *dense)
+{
+	const uint64_t *changed = dense->changed[dense->curChanged];
+	const unsigned char *dirtyRows = dense->dirtyRows[dense->curChanged];
+	wsize_t rows[3], words[3];
+	wsize_t r, w;
+
+	rows[0] = x == 0? dense->x - 1 : x - 1;
+	rows[1] = x;
+	rows[2] = x == dense->x - 1? 0 : x + 1;
+	if (!dirtyRows[rows[0]] && !dirtyRows[rows[1]] && !dirtyRows[rows[2]])
+		return false;
+
+	words[0] = word == 0? dense->numWords - 1 : word - 1;
+	words[1] = word;
+	words[2] = word == dense->numWords - 1? 0 : word + 1;
+
+	for (r = 0; r < 3; ++r) {
+		for (w = 0; w < 3; ++w) {
+			if ((changed[(windex_t)rows[r]*dense->changedStride +
+			     words[w] / 64] >> (words[w] % 64)) & 1)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Sets the bits of the words of the row between both columns that changed
+ */
+inline static void markChanges(wsize_t firstCol, wsize_t lastCol,
+	const unsigned char *mid, const unsigned char *out, uint64_t *changed,
+	unsigned char *dirtyRow)
+{
+	wsize_t j, k, last;
+	unsigned char changes;
+
+	for (j = firstCol; j < lastCol; j += DIRTY_WORD) {
+		last = lastCol - j < DIRTY_WORD? lastCol : j + DIRTY_WORD;
+		changes = 0;
+		for (k = j; k < last; ++k)
+			changes |= mid[k] ^ out[k];
+		if (changes) {
+			changed[j / DIRTY_WORD / 64] |=
+				(uint64_t)1 << (j / DIRTY_WORD % 64);
+			*dirtyRow = 1;
+		}
+	}
+}
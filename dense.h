@@ -0,0 +1,40 @@
+#ifndef DENSE_H_
+#define DENSE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "world.h"
+#include "gol.h"
+#include "stats.h"
+
+struct Dense;
+struct DensityMap;
+
+struct Dense *createDense(wsize_t x, wsize_t y, unsigned char limits,
+	wsize_t halo, unsigned int numThreads, const struct Rule *rule,
+	struct Stats *stats);
+void destroyDense(struct Dense *dense);
+
+void dense_getSize(wsize_t *x, wsize_t *y, const struct Dense *dense);
+wsize_t dense_getHalo(const struct Dense *dense);
+bool dense_haloExpired(const struct Dense *dense);
+void setDenseOffset(wsize_t xOffset, struct Dense *dense);
+void setDenseHashing(bool hashing, struct Dense *dense);
+uint64_t getDenseHash(const struct Dense *dense);
+
+void dense_reviveCell(wsize_t x, wsize_t y, struct Dense *dense);
+void dense_killCell(wsize_t x, wsize_t y, struct Dense *dense);
+bool dense_isCellAlive(wsize_t x, wsize_t y, const struct Dense *dense);
+unsigned long long int dense_getPopulation(const struct Dense *dense);
+void dense_addDensity(struct DensityMap *map, const struct Dense *dense);
+void dense_packWorld(struct PackedRows *packed, const struct Dense *dense);
+void dense_unpackWorld(const struct PackedRows *packed, struct Dense *dense);
+unsigned char *dense_getRow(wsize_t x, struct Dense *dense);
+unsigned char *dense_getHaloRows(wsize_t x, size_t *size, struct Dense *dense);
+
+void dense_iteration(struct Dense *dense, const struct Exchange *exchange);
+void dense_prepare(struct Dense *dense, const struct Exchange *exchange);
+void dense_step(struct Dense *dense);
+void dense_finish(struct Dense *dense);
+
+#endif
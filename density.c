@@ -0,0 +1,126 @@
+#include "density.h"
+#include "io.h"
+#include "malloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+// Room for the PGM header and the name of a frame
+#define MAX_HEADER 64
+#define MAX_FRAME_NAME 32
+
+static void mapBlocks(wsize_t size, wsize_t blocks, wsize_t *area);
+
+
+/*
+ * The map is clamped to the size of the world. The pixel of a cell at global
+ * row i is i*rows/totalX, and likewise for the columns.
+ */
+struct DensityMap *createDensityMap(wsize_t rows, wsize_t cols, wsize_t x,
+	wsize_t y, wsize_t xOffset, wsize_t totalX, const char *dirName)
+{
+	struct DensityMap *map;
+	wsize_t i;
+
+	map = (struct DensityMap *)mallocC(sizeof(struct DensityMap));
+
+	map->rows = rows < totalX? rows : totalX;
+	map->cols = cols < y? cols : y;
+
+	map->counts = (unsigned int *)mallocC(
+		(size_t)map->rows * map->cols * sizeof(unsigned int));
+	map->rowBlock = (wsize_t *)mallocC(x * sizeof(wsize_t));
+	map->colBlock = (wsize_t *)mallocC(y * sizeof(wsize_t));
+	map->rowArea = (wsize_t *)mallocC(map->rows * sizeof(wsize_t));
+	map->colArea = (wsize_t *)mallocC(map->cols * sizeof(wsize_t));
+
+	for (i = 0; i < x; ++i)
+		map->rowBlock[i] = (long long int)(i + xOffset) * map->rows /
+			totalX;
+	for (i = 0; i < y; ++i)
+		map->colBlock[i] = (long long int)i * map->cols / y;
+	mapBlocks(totalX, map->rows, map->rowArea);
+	mapBlocks(y, map->cols, map->colArea);
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &map->ownId);
+	map->dirName = dirName;
+
+	return map;
+}
+
+void freeDensityMap(struct DensityMap *map)
+{
+	free(map->counts);
+	free(map->rowBlock);
+	free(map->colBlock);
+	free(map->rowArea);
+	free(map->colArea);
+	free(map);
+}
+
+inline void clearDensityMap(struct DensityMap *map)
+{
+	memset(map->counts, 0,
+		(size_t)map->rows * map->cols * sizeof(unsigned int));
+}
+
+/*
+ * Sums the maps of all processes into the first one, which writes them as a
+ * binary PGM frame scaled by the area of each block
+ */
+bool saveDensityMap(unsigned long long int generation,
+	struct DensityMap *map)
+{
+	char filename[MAX_FRAME_NAME];
+	unsigned char *buffer, *pixels;
+	size_t buffSize, numPixels, pixel;
+	int header;
+	wsize_t i, j;
+	unsigned long long int area;
+	bool ret;
+
+	numPixels = (size_t)map->rows * map->cols;
+	MPI_Reduce(map->ownId? map->counts : MPI_IN_PLACE, map->counts,
+		numPixels, MPI_UNSIGNED, MPI_SUM, 0,
+		MPI_COMM_WORLD);
+
+	if (map->ownId != 0) return true;
+
+	buffSize = MAX_HEADER + numPixels;
+	buffer = (unsigned char *)mallocC(buffSize);
+
+	header = snprintf((char *)buffer, MAX_HEADER, "P5\n%ld %ld\n255\n",
+		(long int)map->cols, (long int)map->rows);
+	pixels = buffer + header;
+
+	for (i = 0; i < map->rows; ++i) {
+		for (j = 0; j < map->cols; ++j) {
+			pixel = (size_t)i*map->cols + j;
+			area = (unsigned long long int)map->rowArea[i] *
+				map->colArea[j];
+			pixels[pixel] = ((unsigned long long int)
+				map->counts[pixel] * 255 + area/2) / area;
+		}
+	}
+
+	snprintf(filename, MAX_FRAME_NAME, "%06llu.pgm", generation);
+	ret = writeBuffer((char *)buffer, header + numPixels,
+		map->dirName, filename, "w");
+
+	free(buffer);
+
+	return ret;
+}
+
+// Number of cells of each block, as they are assigned in createDensityMap()
+static void mapBlocks(wsize_t size, wsize_t blocks, wsize_t *area)
+{
+	wsize_t i;
+
+	for (i = 0; i < blocks; ++i) {
+		// First cell of the next block, ceil((i+1)*size/blocks)
+		area[i] = ((long long int)(i+1) * size + blocks - 1) / blocks -
+			((long long int)i * size + blocks - 1) / blocks;
+	}
+}
@@ -0,0 +1,36 @@
+#ifndef DENSITY_H_
+#define DENSITY_H_
+
+#include <stdbool.h>
+#include "world.h"
+
+/*
+ * Downsampled map of the world: each pixel counts the alive cells of a block
+ * of rows and columns. The blocks of the rows in the portion of this process
+ * are precomputed, so the engines just add each alive cell to its pixel.
+ */
+struct DensityMap {
+	wsize_t rows;
+	wsize_t cols;
+	unsigned int *counts;
+
+	// Pixel row of each local row and pixel column of each column
+	wsize_t *rowBlock;
+	wsize_t *colBlock;
+
+	// Cells of the blocks of each pixel row and column
+	wsize_t *rowArea;
+	wsize_t *colArea;
+
+	int ownId;
+	const char *dirName;
+};
+
+struct DensityMap *createDensityMap(wsize_t rows, wsize_t cols, wsize_t x,
+	wsize_t y, wsize_t xOffset, wsize_t totalX, const char *dirName);
+void freeDensityMap(struct DensityMap *map);
+void clearDensityMap(struct DensityMap *map);
+bool saveDensityMap(unsigned long long int generation,
+	struct DensityMap *map);
+
+#endif
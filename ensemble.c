@@ -0,0 +1,253 @@
+#include "ensemble.h"
+#include "cycle.h"
+#include "malloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Up to 64 worlds of the same size and rule stored bit-sliced: each cell is a
+ * word whose bit k is the state of that cell in the world k. The neighbors are
+ * added with bitwise adders, so a single pass advances all the worlds.
+ *
+ * As in the dense engine there are two buffers with a ghost row and column at
+ * each side, but every world wraps around its own edges.
+ */
+struct Ensemble {
+	wsize_t x;
+	wsize_t y;
+	wsize_t stride;
+
+	uint64_t *buffers[2];
+	uint64_t *cur;
+	uint64_t *next;
+
+	struct Rule rule;
+	void (*step)(const struct Ensemble *ensemble);
+};
+
+static void fillGhosts(struct Ensemble *ensemble);
+static void step(const struct Ensemble *ensemble, bool fixed,
+	unsigned int birth, unsigned int survive);
+static void step_generic(const struct Ensemble *ensemble);
+
+/*
+ * Instantiates step for a fixed rule, as the other engines do
+ */
+#define DEFINE_STEP(name, birth, survive)				\
+	static void step_##name(const struct Ensemble *ensemble)	\
+	{								\
+		step(ensemble, true, birth, survive);			\
+	}
+
+DEFINE_STEP(B3S23, RULE_3, RULE_2 | RULE_3)
+DEFINE_STEP(B36S23, RULE_3 | RULE_6, RULE_2 | RULE_3)
+DEFINE_STEP(B3678S34678, RULE_3 | RULE_6 | RULE_7 | RULE_8,
+	RULE_3 | RULE_4 | RULE_6 | RULE_7 | RULE_8)
+DEFINE_STEP(B2S, RULE_2, 0)
+
+// Specialized kernels, any other rule reads the masks at run time
+static const struct Kernel {
+	struct Rule rule;
+	void (*step)(const struct Ensemble *ensemble);
+} kernels[] = {
+	{{RULE_3, RULE_2 | RULE_3}, step_B3S23},
+	{{RULE_3 | RULE_6, RULE_2 | RULE_3}, step_B36S23},
+	{{RULE_3 | RULE_6 | RULE_7 | RULE_8,
+	  RULE_3 | RULE_4 | RULE_6 | RULE_7 | RULE_8}, step_B3678S34678},
+	{{RULE_2, 0}, step_B2S}
+};
+
+
+struct Ensemble *createEnsemble(wsize_t x, wsize_t y, const struct Rule *rule)
+{
+	struct Ensemble *ensemble;
+	size_t bufferSize;
+	unsigned int i;
+
+	ensemble = (struct Ensemble *)mallocC(sizeof(struct Ensemble));
+
+	ensemble->x = x;
+	ensemble->y = y;
+	ensemble->stride = y + 2;
+	ensemble->rule = *rule;
+
+	// Allocate memory
+	bufferSize = (size_t)(x + 2) * ensemble->stride * sizeof(uint64_t);
+	ensemble->buffers[0] = (uint64_t *)mallocC(bufferSize);
+	ensemble->buffers[1] = (uint64_t *)mallocC(bufferSize);
+	memset(ensemble->buffers[0], 0, bufferSize);
+	memset(ensemble->buffers[1], 0, bufferSize);
+
+	// Point to the first cell, after the ghost row and column
+	ensemble->cur  = ensemble->buffers[0] + ensemble->stride + 1;
+	ensemble->next = ensemble->buffers[1] + ensemble->stride + 1;
+
+	ensemble->step = step_generic;
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+		if (kernels[i].rule.birth == rule->birth &&
+		    kernels[i].rule.survive == rule->survive)
+			ensemble->step = kernels[i].step;
+	}
+
+	return ensemble;
+}
+
+void destroyEnsemble(struct Ensemble *ensemble)
+{
+	free(ensemble->buffers[0]);
+	free(ensemble->buffers[1]);
+	free(ensemble);
+}
+
+void ensemble_reviveCell(wsize_t x, wsize_t y, unsigned int lane,
+	struct Ensemble *ensemble)
+{
+	ensemble->cur[x*ensemble->stride + y] |= (uint64_t)1 << lane;
+}
+
+void ensemble_getPopulations(unsigned long long int *populations,
+	const struct Ensemble *ensemble)
+{
+	wsize_t i, j;
+	unsigned int lane;
+	uint64_t cell;
+
+	for (lane = 0; lane < ENSEMBLE_LANES; ++lane)
+		populations[lane] = 0;
+
+	for (i = 0; i < ensemble->x; ++i) {
+		for (j = 0; j < ensemble->y; ++j) {
+			cell = ensemble->cur[(windex_t)i*ensemble->stride + j];
+			for (; cell; cell &= cell - 1)
+				++populations[__builtin_ctzll(cell)];
+		}
+	}
+}
+
+/*
+ * Zobrist hash of each world, the same the other engines compute
+ */
+void ensemble_getHashes(uint64_t *hashes, const struct Ensemble *ensemble)
+{
+	wsize_t i, j;
+	unsigned int lane;
+	uint64_t cell, key;
+
+	for (lane = 0; lane < ENSEMBLE_LANES; ++lane)
+		hashes[lane] = 0;
+
+	for (i = 0; i < ensemble->x; ++i) {
+		for (j = 0; j < ensemble->y; ++j) {
+			cell = ensemble->cur[(windex_t)i*ensemble->stride + j];
+			if (!cell) continue;
+
+			key = zobristKey(i, j);
+			for (; cell; cell &= cell - 1)
+				hashes[__builtin_ctzll(cell)] ^= key;
+		}
+	}
+}
+
+void ensemble_iteration(struct Ensemble *ensemble)
+{
+	uint64_t *tmp;
+
+	fillGhosts(ensemble);
+	ensemble->step(ensemble);
+
+	tmp = ensemble->cur;
+	ensemble->cur = ensemble->next;
+	ensemble->next = tmp;
+}
+
+static void fillGhosts(struct Ensemble *ensemble)
+{
+	wsize_t i;
+	uint64_t *row;
+	size_t rowSize = ensemble->y * sizeof(uint64_t);
+
+	memcpy(&ensemble->cur[-ensemble->stride],
+		&ensemble->cur[(windex_t)(ensemble->x - 1) * ensemble->stride], rowSize);
+	memcpy(&ensemble->cur[(windex_t)ensemble->x * ensemble->stride],
+		ensemble->cur, rowSize);
+
+	for (i = -1; i <= ensemble->x; ++i) {
+		row = &ensemble->cur[(windex_t)i*ensemble->stride];
+		row[-1] = row[ensemble->y - 1];
+		row[ensemble->y] = row[0];
+	}
+}
+
+/*
+ * With a fixed rule, bit n of each mask is set when it applies with n alive
+ * neighbors, and the comparisons below are folded by the compiler
+ */
+inline static void step(const struct Ensemble *ensemble, bool fixed,
+	unsigned int birth, unsigned int survive)
+{
+	wsize_t i, j;
+	const uint64_t *up, *mid, *down;
+	uint64_t *out;
+	uint64_t s0, s1, s2, c0, c1, c2, carry;
+	uint64_t ones, twos, t, fours0, fours1;
+	uint64_t bits[4];
+	uint64_t eq, born, lives;
+	int n, b;
+
+	if (!fixed) {
+		birth = ensemble->rule.birth;
+		survive = ensemble->rule.survive;
+	}
+
+	for (i = 0; i < ensemble->x; ++i) {
+		mid = &ensemble->cur[(windex_t)i*ensemble->stride];
+		up = mid - ensemble->stride;
+		down = mid + ensemble->stride;
+		out = &ensemble->next[(windex_t)i*ensemble->stride];
+
+		for (j = 0; j < ensemble->y; ++j) {
+			// Full adders of the eight neighbors: the sums weigh 1
+			// and the carries 2
+			s0 = up[j-1] ^ up[j] ^ up[j+1];
+			c0 = (up[j-1] & up[j]) | (up[j+1] & (up[j-1] ^ up[j]));
+			s1 = mid[j-1] ^ mid[j+1] ^ down[j-1];
+			c1 = (mid[j-1] & mid[j+1]) |
+				(down[j-1] & (mid[j-1] ^ mid[j+1]));
+			s2 = down[j] ^ down[j+1];
+			c2 = down[j] & down[j+1];
+
+			ones = s0 ^ s1 ^ s2;
+			carry = (s0 & s1) | (s2 & (s0 ^ s1));
+
+			// Carries weighing 2, and what they carry weighs 4
+			t = c0 ^ c1 ^ c2;
+			fours0 = (c0 & c1) | (c2 & (c0 ^ c1));
+			twos = t ^ carry;
+			fours1 = t & carry;
+
+			bits[0] = ones;
+			bits[1] = twos;
+			bits[2] = fours0 ^ fours1;
+			bits[3] = fours0 & fours1;
+
+			born = lives = 0;
+			for (n = 1; n <= 8; ++n) {
+				if (!(((birth | survive) >> (n-1)) & 1)) continue;
+
+				eq = ~(uint64_t)0;
+				for (b = 0; b < 4; ++b)
+					eq &= (n >> b) & 1? bits[b] : ~bits[b];
+
+				if ((birth >> (n-1)) & 1) born |= eq;
+				if ((survive >> (n-1)) & 1) lives |= eq;
+			}
+
+			out[j] = (mid[j] & lives) | (~mid[j] & born);
+		}
+	}
+}
+
+static void step_generic(const struct Ensemble *ensemble)
+{
+	step(ensemble, false, 0, 0);
+}
@@ -0,0 +1,24 @@
+#ifndef ENSEMBLE_H_
+#define ENSEMBLE_H_
+
+#include <stdint.h>
+#include "world.h"
+#include "gol.h"
+
+// Worlds advanced at once, one per bit of a word
+#define ENSEMBLE_LANES 64
+
+struct Ensemble;
+
+struct Ensemble *createEnsemble(wsize_t x, wsize_t y, const struct Rule *rule);
+void destroyEnsemble(struct Ensemble *ensemble);
+
+void ensemble_reviveCell(wsize_t x, wsize_t y, unsigned int lane,
+	struct Ensemble *ensemble);
+void ensemble_getPopulations(unsigned long long int *populations,
+	const struct Ensemble *ensemble);
+void ensemble_getHashes(uint64_t *hashes, const struct Ensemble *ensemble);
+
+void ensemble_iteration(struct Ensemble *ensemble);
+
+#endif
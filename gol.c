@@ -2,28 +2,72 @@
 #include "world.h"
 #include "list.h"
 #include "malloc.h"
+#include "steal.h"
+#include "affinity.h"
 #include <stdlib.h>
+#include <ctype.h>
 #include <omp.h>
 
-enum CellProcessing{
-	GOL_REVIVE,
-	GOL_KILL,
-	GOL_SURVIVE,
-	GOL_KEEP_DEAD
-};
+// Active tiles taken at once by a thread
+#define CHUNK_TILES 32
 
 struct GOL {
 	struct World *world;
 	struct Stats *stats;
 
-	struct list_head *toRevive;
-	struct list_head *toKill;
-	const struct Rule *rule;
+	struct CellVector *toRevive;
+	struct CellVector *toKill;
+	struct Rule rule;
+	void (*checkTile)(unsigned int tile, struct GOL *gol);
 	unsigned int numThreads;
+	struct Steal *steal;
+
+	// Generation being checked
+	const struct Exchange *exchange;
+	wsize_t tilesX;
+	double ccTime;
+
+	unsigned long long int allocations;
+	unsigned int resortPeriod;
+	unsigned long long int generation;
 };
 
-static enum CellProcessing checkRule(struct Cell *cell,const struct Rule *rule);
-static bool checkSubrule(unsigned char subrule, unsigned char aliveCounter);
+static void exchangeLimits(const struct Exchange *exchange, wsize_t tilesX,
+	struct GOL *gol);
+static void checkActiveTiles(struct GOL *gol);
+static void checkTileRow(wsize_t row, struct GOL *gol);
+static void checkTile(unsigned int tile, unsigned int birth,
+	unsigned int survive, struct GOL *gol);
+static void checkTile_generic(unsigned int tile, struct GOL *gol);
+static void countAllocations(struct GOL *gol);
+
+/*
+ * Instantiates checkTile for a fixed rule, so its masks are constants the
+ * compiler can fold into the comparisons
+ */
+#define DEFINE_CHECK_TILE(name, birth, survive)				\
+	static void checkTile_##name(unsigned int tile, struct GOL *gol)	\
+	{								\
+		checkTile(tile, birth, survive, gol);			\
+	}
+
+DEFINE_CHECK_TILE(B3S23, RULE_3, RULE_2 | RULE_3)
+DEFINE_CHECK_TILE(B36S23, RULE_3 | RULE_6, RULE_2 | RULE_3)
+DEFINE_CHECK_TILE(B3678S34678, RULE_3 | RULE_6 | RULE_7 | RULE_8,
+	RULE_3 | RULE_4 | RULE_6 | RULE_7 | RULE_8)
+DEFINE_CHECK_TILE(B2S, RULE_2, 0)
+
+// Specialized kernels, any other rule uses the generic one
+static const struct Kernel {
+	struct Rule rule;
+	void (*checkTile)(unsigned int tile, struct GOL *gol);
+} kernels[] = {
+	{{RULE_3, RULE_2 | RULE_3}, checkTile_B3S23},
+	{{RULE_3 | RULE_6, RULE_2 | RULE_3}, checkTile_B36S23},
+	{{RULE_3 | RULE_6 | RULE_7 | RULE_8,
+	  RULE_3 | RULE_4 | RULE_6 | RULE_7 | RULE_8}, checkTile_B3678S34678},
+	{{RULE_2, 0}, checkTile_B2S}
+};
 
 struct GOL *golInit(unsigned int numThreads, const struct Rule *rule,
 	struct World *world, struct Stats *stats)
@@ -33,20 +77,31 @@ struct GOL *golInit(unsigned int numThreads, const struct Rule *rule,
 
 	// Allocate memory
 	gol = (struct GOL *)mallocC(sizeof(struct GOL));
-	gol->toRevive = (struct list_head *)
-		mallocC(numThreads * sizeof(struct list_head));
-	gol->toKill = (struct list_head *)
-		mallocC(numThreads * sizeof(struct list_head));
+	gol->toRevive = (struct CellVector *)
+		mallocC(numThreads * sizeof(struct CellVector));
+	gol->toKill = (struct CellVector *)
+		mallocC(numThreads * sizeof(struct CellVector));
 
-	gol->rule = rule;
+	gol->rule = *rule;
+	gol->checkTile = checkTile_generic;
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+		if (kernels[i].rule.birth == rule->birth &&
+		    kernels[i].rule.survive == rule->survive)
+			gol->checkTile = kernels[i].checkTile;
+	}
 	gol->world = world;
 	gol->numThreads = numThreads;
+	gol->steal = createSteal(numThreads);
 	gol->stats = stats;
+	gol->resortPeriod = 0;
+	gol->exchange = NULL;
+	gol->generation = 0;
+	gol->allocations = 0;
 
-	// Initialize lists
+	// Initialize vectors
 	for (i = 0; i < numThreads; ++i) {
-		INIT_LIST_HEAD(&gol->toRevive[i]);
-		INIT_LIST_HEAD(&gol->toKill[i]);
+		initVector(&gol->toRevive[i]);
+		initVector(&gol->toKill[i]);
 	}
 
 	omp_set_num_threads(numThreads);
@@ -56,122 +111,275 @@ struct GOL *golInit(unsigned int numThreads, const struct Rule *rule,
 
 void golEnd(struct GOL *gol)
 {
+	unsigned int i;
+
+	for (i = 0; i < gol->numThreads; ++i) {
+		freeVector(&gol->toRevive[i]);
+		freeVector(&gol->toKill[i]);
+	}
 	free(gol->toRevive);
 	free(gol->toKill);
+	freeSteal(gol->steal);
 	free(gol);
 }
 
-void iteration(struct GOL *gol)
+/*
+ * The active tiles are split between the threads, which steal chunks from
+ * each other as they run out of them. With an exchange, the master thread
+ * sends and receives the limits first, and the rest steal its tiles.
+ */
+void iteration(struct GOL *gol, const struct Exchange *exchange)
 {
-	struct Cell *cell;
-	unsigned int i;
-	unsigned int count;
-	unsigned int threadNum;
-	double ccTime, wupTime, thTime;
+	gol_prepare(gol, exchange);
+
+	#pragma omp parallel shared(gol)
+	gol_check(gol);
+
+	gol_update(gol);
+}
+
+/*
+ * Sets the cells of the last generation and splits the active tiles between
+ * the threads. Called by a single thread before gol_check.
+ */
+void gol_prepare(struct GOL *gol, const struct Exchange *exchange)
+{
+	unsigned int first, last;
+	unsigned int numTiles;
+	wsize_t tilesY;
 
 	// TODO: it can be multithread?
 	reviveCells(&gol->toRevive[0], gol->world);
 	killCells(&gol->toKill[0], gol->world);
+	clearVector(&gol->toRevive[0]);
+	clearVector(&gol->toKill[0]);
+	// Those cells were set from outside, as the seeded or loaded ones, and
+	// they are not births or deaths
+	resetCensus(gol->world);
 
-	ccTime = startMeasurement();
-	#pragma omp parallel shared(gol) private(cell, count, threadNum, thTime)
-	{
-		thTime = startMeasurement();
+	gol->ccTime = startMeasurement();
 
-		threadNum = omp_get_thread_num();
-
-		for (cell = wit_first_split(&count, threadNum, gol->world);
-		     wit_done_split(count, gol->world);
-		     cell = wit_next_split(cell, &count, gol->numThreads))
-		{
-			switch (checkRule(cell, gol->rule)) {
-			case GOL_REVIVE:
-				addToList(cell, &gol->toRevive[threadNum]);
-				break;
-			case GOL_KILL:
-				addToList(cell, &gol->toKill[threadNum]);
-				break;
-			case GOL_SURVIVE:
-			case GOL_KEEP_DEAD:
-			default:
-				break;
-			}
-		}
+	// Only the tiles with changes in its neighborhood can change
+	updateActiveTiles(gol->world);
+	numTiles = getNumActiveTiles(gol->world);
+	getTiles(&gol->tilesX, &tilesY, gol->world);
 
-		endMeasurement(thTime, threads[threadNum], gol->stats);
+	// Active tiles are sorted, so the interior ones are contiguous
+	first = 0;
+	last = numTiles;
+	if (exchange) {
+		while (first < last && getActiveTile(first, gol->world) <
+		       (unsigned int)tilesY)
+			++first;
+		while (last > first && getActiveTile(last-1, gol->world) >=
+		       (unsigned int)((gol->tilesX - 1) * tilesY))
+			--last;
 	}
-	endMeasurement(ccTime, cellChecking, gol->stats);
+
+	gol->exchange = exchange;
+	steal_reset(first, last, CHUNK_TILES, gol->steal);
+}
+
+/*
+ * Checks the tiles, called by every thread of the team. Only the master
+ * thread communicates, so MPI_THREAD_FUNNELED is enough.
+ */
+void gol_check(struct GOL *gol)
+{
+	pinThread();
+
+	#pragma omp master
+	if (gol->exchange) exchangeLimits(gol->exchange, gol->tilesX, gol);
+
+	checkActiveTiles(gol);
+}
+
+/*
+ * Applies the births and deaths found by the threads. Called by a single
+ * thread once all of them are done.
+ */
+void gol_update(struct GOL *gol)
+{
+	unsigned int i;
+	double wupTime;
+
+	steal_addStats(gol->stats, gol->steal);
+	endMeasurement(gol->ccTime, cellChecking, gol->stats);
 
 	wupTime = startMeasurement();
-	// Add lists
+	// Each vector holds its cells in the order of the tiles, which keeps
+	// neighbors together better than sorting them by row
 	for (i = 0; i < gol->numThreads; ++i) {
 		reviveCells(&gol->toRevive[i], gol->world);
-		freeList(&gol->toRevive[i]);
+		clearVector(&gol->toRevive[i]);
 	}
 
-	// Free lists
 	for (i = 0; i < gol->numThreads; ++i) {
 		killCells(&gol->toKill[i], gol->world);
-		freeList(&gol->toKill[i]);
+		clearVector(&gol->toKill[i]);
 	}
+
+	// Births and deaths scatter the cells in memory, gather them again
+	++(gol->generation);
+	if (gol->resortPeriod && gol->generation % gol->resortPeriod == 0)
+		sortCells(gol->world);
+
+	countAllocations(gol);
 	endMeasurement(wupTime, worldUpdate, gol->stats);
 }
 
-enum CellProcessing checkRule(struct Cell *cell, const struct Rule *rule)
+/*
+ * Sort the cells in memory every 'period' generations. 0 disables it.
+ */
+inline void setResortPeriod(unsigned int period, struct GOL *gol)
 {
-	enum CellProcessing cProc;
-	unsigned char aliveCounter = 0;
-	bool satisfy;
-	bool cellAlive;
+	gol->resortPeriod = period;
+}
+
+/*
+ * Adds to the stats the cells and vector growths allocated in this generation
+ */
+static void countAllocations(struct GOL *gol)
+{
+	unsigned int i;
+	unsigned long long int allocations;
+
+	allocations = getAllocations(gol->world);
+	for (i = 0; i < gol->numThreads; ++i) {
+		allocations += gol->toRevive[i].growths;
+		allocations += gol->toKill[i].growths;
+	}
+
+	gol->stats->allocations +=
+		gol->stats->avgFactor * (allocations - gol->allocations);
+	gol->allocations = allocations;
+}
 
+/*
+ * Sends the limits and receives them in order, checking the tile row at each
+ * limit once the boundary of that side is set
+ */
+static void exchangeLimits(const struct Exchange *exchange, wsize_t tilesX,
+	struct GOL *gol)
+{
+	exchange->send(exchange->data);
 
-	cellAlive = isCellAlive(cell);
-	aliveCounter = getCellRefs(cell);
+	exchange->receive(WB_TOP, exchange->data);
+	// With a single row of tiles, both limits are in it
+	if (tilesX > 1) checkTileRow(0, gol);
 
-	if (cellAlive) {
-		satisfy = checkSubrule(rule->survive, aliveCounter);
+	exchange->receive(WB_BOTTOM, exchange->data);
+	checkTileRow(tilesX - 1, gol);
+}
 
-		if (satisfy)
-			cProc = GOL_SURVIVE;
-		else
-			cProc = GOL_KILL;
+static void checkActiveTiles(struct GOL *gol)
+{
+	unsigned int i, first, last;
+	double thTime;
+
+	while (steal_next(&first, &last, gol->steal)) {
+		thTime = startMeasurement();
+
+		for (i = first; i < last; ++i)
+			gol->checkTile(getActiveTile(i, gol->world), gol);
+
+		endMeasurement(thTime, threads[omp_get_thread_num()],
+			gol->stats);
 	}
-	else{
-		satisfy = checkSubrule(rule->birth, aliveCounter);
+}
 
-		if (satisfy)
-			cProc = GOL_REVIVE;
-		else
-			cProc = GOL_KEEP_DEAD;
+/*
+ * Checks the tiles of a row at a limit, including the ones marked when its
+ * boundary was set
+ */
+static void checkTileRow(wsize_t row, struct GOL *gol)
+{
+	wsize_t tilesX, tilesY;
+	unsigned int tile;
+	double thTime;
+
+	thTime = startMeasurement();
+
+	getTiles(&tilesX, &tilesY, gol->world);
+	for (tile = row * tilesY; tile < (unsigned int)((row + 1) * tilesY);
+	     ++tile) {
+		if (isTileActive(tile, gol->world))
+			gol->checkTile(tile, gol);
 	}
 
-	return cProc;
+	endMeasurement(thTime, threads[omp_get_thread_num()], gol->stats);
 }
 
-inline static bool checkSubrule(unsigned char subrule,
-	unsigned char aliveCounter)
+/*
+ * Bit n of each mask is set when the rule applies with n alive neighbors
+ */
+inline static void checkTile(unsigned int tile, unsigned int birth,
+	unsigned int survive, struct GOL *gol)
 {
-	int i;
-	unsigned char ruleIndx;
-	bool satisfy = false;
+	struct Cell *cell;
+	unsigned int threadNum = omp_get_thread_num();
+	unsigned int refs;
 
-	for (i = 1, ruleIndx = 1;
-	     ruleIndx < (1<<7) && !satisfy ;
-	     ++i, ruleIndx <<= 1)
+	birth <<= 1;
+	survive <<= 1;
+
+	for (cell = wit_first_tile(tile, gol->world);
+	     wit_done_tile(cell, tile, gol->world);
+	     cell = wit_next(cell))
 	{
-		if (subrule & ruleIndx)
-			satisfy |= aliveCounter == i;
+		refs = getCellRefs(cell);
+
+		if (isCellAlive(cell)) {
+			if (!((survive >> refs) & 1))
+				addToVector(cell, &gol->toKill[threadNum],
+					gol->world);
+		} else if ((birth >> refs) & 1) {
+			addToVector(cell, &gol->toRevive[threadNum],
+				gol->world);
+		}
+	}
+}
+
+static void checkTile_generic(unsigned int tile, struct GOL *gol)
+{
+	checkTile(tile, gol->rule.birth, gol->rule.survive, gol);
+}
+
+/*
+ * Reads a rule in the B/S notation, as "B3/S23". Births without alive neighbors
+ * can't be simulated, so only counts from 1 to 8 are accepted.
+ */
+bool parseRule(const char *str, struct Rule *rule)
+{
+	unsigned char *subrule;
+
+	if (toupper(*str) != 'B') return false;
+
+	subrule = &rule->birth;
+	rule->birth = 0;
+	rule->survive = 0;
+
+	for (++str; *str != '\0'; ++str) {
+		if (*str >= '1' && *str <= '8') {
+			*subrule |= 1 << (*str - '1');
+		} else if (*str == '/' && subrule == &rule->birth &&
+			   toupper(str[1]) == 'S') {
+			subrule = &rule->survive;
+			++str;
+		} else {
+			return false;
+		}
 	}
 
-	return satisfy;
+	return subrule == &rule->survive;
 }
 
 inline void gol_reviveCell(wsize_t x, wsize_t y, struct GOL *gol)
 {
-	addToList_coords(x, y, true, &gol->toRevive[0], gol->world);
+	addToVector_coords(x, y, &gol->toRevive[0], gol->world);
 }
 
 inline void gol_killCell(wsize_t x, wsize_t y, struct GOL *gol)
 {
-	addToList_coords(x, y, false, &gol->toRevive[0], gol->world);
+	addToVector_coords(x, y, &gol->toKill[0], gol->world);
 }
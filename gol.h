@@ -15,6 +15,16 @@
 
 struct GOL;
 
+/*
+ * Communication of the limits, overlapped with the checking of the cells.
+ * 'receive' is called for the top side and then for the bottom one.
+ */
+struct Exchange {
+	void (*send)(void *data);
+	void (*receive)(enum WorldBound bound, void *data);
+	void *data;
+};
+
 struct Rule {
 	unsigned char birth;
 	unsigned char survive;
@@ -25,10 +35,16 @@ static const struct Rule rule_B3S23 = {
 	RULE_2 | RULE_3
 };
 
+bool parseRule(const char *str, struct Rule *rule);
+
 struct GOL *golInit(unsigned int numThreads, const struct Rule *rule,
 	struct World *world, struct Stats *stats);
 void golEnd(struct GOL *gol);
-void iteration(struct GOL *gol);
+void iteration(struct GOL *gol, const struct Exchange *exchange);
+void gol_prepare(struct GOL *gol, const struct Exchange *exchange);
+void gol_check(struct GOL *gol);
+void gol_update(struct GOL *gol);
+void setResortPeriod(unsigned int period, struct GOL *gol);
 void gol_reviveCell(wsize_t x, wsize_t y, struct GOL *gol);
 void gol_killCell(wsize_t x, wsize_t y, struct GOL *gol);
 
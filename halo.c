@@ -0,0 +1,297 @@
+#include "halo.h"
+#include "malloc.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <mpi.h>
+
+// Cache line size, for the alignment of the boundaries
+#define LINE_SIZE 64
+
+/*
+ * Each process publishes its boundaries in a window shared with the processes
+ * of the same host, and the neighbors read them from there. There are two
+ * copies used in alternate generations: a copy is only written again after
+ * the neighbors publish the next generation, which they do once they have
+ * read it.
+ */
+struct ShmHeader {
+	atomic_ullong ready;
+	wsize_t sizes[2][2][2];
+};
+
+// Room before the boundaries of each process
+#define HEADER_SIZE \
+	((sizeof(struct ShmHeader) + LINE_SIZE - 1) / LINE_SIZE * LINE_SIZE)
+
+struct ShmHalo {
+	MPI_Comm comm;
+	MPI_Win win;
+	wsize_t y;
+
+	struct ShmHeader *own;
+	struct ShmHeader *neighbors[2];
+
+	struct Boundary *tx;
+	struct Boundary *rx;
+
+	unsigned long long generation;
+	int copy;
+};
+
+/*
+ * Each process exposes the sizes and the arrays of its received boundaries,
+ * and the neighbors put theirs directly there. Every generation is an epoch
+ * between the neighbors only.
+ */
+struct RmaHalo {
+	MPI_Win win;
+	MPI_Group neighborGroup;
+	int neighborIds[2];
+	wsize_t y;
+
+	wsize_t *exposed;
+
+	struct Boundary *tx;
+	struct Boundary *rx;
+};
+
+static wsize_t *getArray(struct ShmHeader *header, int copy,
+	enum WorldBound bound, enum BoundaryType btype, wsize_t y);
+static void setTxCopy(struct ShmHalo *halo);
+static MPI_Aint getRmaDisp(enum WorldBound bound, enum BoundaryType btype,
+	wsize_t y);
+
+
+struct ShmHalo *createShmHalo(const int neighborIds[2], wsize_t y,
+	struct Boundary *tx, struct Boundary *rx)
+{
+	struct ShmHalo *halo;
+	MPI_Group worldGroup, shmGroup;
+	MPI_Aint size;
+	int ranks[2];
+	int dispUnit;
+	int bound;
+
+	halo = (struct ShmHalo *)mallocC(sizeof(struct ShmHalo));
+	halo->y = y;
+	halo->tx = tx;
+	halo->rx = rx;
+	halo->generation = 0;
+	halo->copy = 0;
+
+	// Window shared by the processes of the host
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+		MPI_INFO_NULL, &halo->comm);
+
+	size = HEADER_SIZE + 2*2*2 * y * sizeof(wsize_t);
+	MPI_Win_allocate_shared(size, 1, MPI_INFO_NULL, halo->comm,
+		&halo->own, &halo->win);
+	MPI_Win_lock_all(MPI_MODE_NOCHECK, halo->win);
+
+	atomic_init(&halo->own->ready, 0);
+
+	// Neighbors in other hosts are still reached with messages
+	MPI_Comm_group(MPI_COMM_WORLD, &worldGroup);
+	MPI_Comm_group(halo->comm, &shmGroup);
+	MPI_Group_translate_ranks(worldGroup, 2, neighborIds, shmGroup, ranks);
+	MPI_Group_free(&worldGroup);
+	MPI_Group_free(&shmGroup);
+
+	for (bound = WB_TOP; bound <= WB_BOTTOM; ++bound) {
+		halo->neighbors[bound] = NULL;
+		if (ranks[bound] == MPI_UNDEFINED) continue;
+
+		MPI_Win_shared_query(halo->win, ranks[bound], &size, &dispUnit,
+			&halo->neighbors[bound]);
+	}
+
+	// Counters must be initialized before anyone reads them
+	MPI_Win_sync(halo->win);
+	MPI_Barrier(halo->comm);
+
+	setTxCopy(halo);
+
+	return halo;
+}
+
+void freeShmHalo(struct ShmHalo *halo)
+{
+	MPI_Win_unlock_all(halo->win);
+	MPI_Win_free(&halo->win);
+	MPI_Comm_free(&halo->comm);
+	free(halo);
+}
+
+inline bool shmHalo_isShared(enum WorldBound bound,
+	const struct ShmHalo *halo)
+{
+	return halo->neighbors[bound] != NULL;
+}
+
+/*
+ * Makes the boundaries written in this generation visible to the neighbors
+ */
+void shmHalo_publish(struct ShmHalo *halo)
+{
+	int bound, btype;
+
+	for (bound = WB_TOP; bound <= WB_BOTTOM; ++bound) {
+		for (btype = TO_REVIVE; btype <= TO_KILL; ++btype) {
+			halo->own->sizes[halo->copy][bound][btype] =
+				halo->tx->boundariesSizes[bound][btype];
+		}
+	}
+
+	atomic_store_explicit(&halo->own->ready, ++(halo->generation),
+		memory_order_release);
+}
+
+/*
+ * Waits for the neighbor to publish this generation, and points the received
+ * boundary to the one it sent us, without copying it
+ */
+void shmHalo_receive(enum WorldBound bound, enum BoundaryType btype,
+	struct ShmHalo *halo)
+{
+	struct ShmHeader *neighbor = halo->neighbors[bound];
+	enum WorldBound opposite = OPPOSITE(bound);
+
+	while (atomic_load_explicit(&neighbor->ready, memory_order_acquire) <
+	       halo->generation)
+		sched_yield();
+
+	halo->rx->boundaries[bound][btype] =
+		getArray(neighbor, halo->copy, opposite, btype, halo->y);
+	halo->rx->boundariesSizes[bound][btype] =
+		neighbor->sizes[halo->copy][opposite][btype];
+}
+
+/*
+ * Switches to the other copy for the boundaries of the next generation
+ */
+void shmHalo_next(struct ShmHalo *halo)
+{
+	halo->copy ^= 1;
+	setTxCopy(halo);
+}
+
+inline static wsize_t *getArray(struct ShmHeader *header, int copy,
+	enum WorldBound bound, enum BoundaryType btype, wsize_t y)
+{
+	wsize_t *arrays = (wsize_t *)((char *)header + HEADER_SIZE);
+
+	return &arrays[((copy*2 + bound)*2 + btype) * y];
+}
+
+static void setTxCopy(struct ShmHalo *halo)
+{
+	int bound, btype;
+
+	for (bound = WB_TOP; bound <= WB_BOTTOM; ++bound) {
+		if (!shmHalo_isShared(bound, halo)) continue;
+
+		for (btype = TO_REVIVE; btype <= TO_KILL; ++btype) {
+			halo->tx->boundaries[bound][btype] = getArray(halo->own,
+				halo->copy, bound, btype, halo->y);
+		}
+	}
+}
+
+struct RmaHalo *createRmaHalo(const int neighborIds[2], wsize_t y,
+	struct Boundary *tx, struct Boundary *rx)
+{
+	struct RmaHalo *halo;
+	MPI_Group worldGroup;
+	int numNeighbors;
+	int bound, btype;
+
+	halo = (struct RmaHalo *)mallocC(sizeof(struct RmaHalo));
+	halo->neighborIds[WB_TOP] = neighborIds[WB_TOP];
+	halo->neighborIds[WB_BOTTOM] = neighborIds[WB_BOTTOM];
+	halo->y = y;
+	halo->tx = tx;
+	halo->rx = rx;
+
+	// Four sizes followed by the four arrays
+	MPI_Win_allocate((4 + 4*y) * sizeof(wsize_t), sizeof(wsize_t),
+		MPI_INFO_NULL, MPI_COMM_WORLD, &halo->exposed, &halo->win);
+
+	for (bound = WB_TOP; bound <= WB_BOTTOM; ++bound) {
+		for (btype = TO_REVIVE; btype <= TO_KILL; ++btype) {
+			rx->boundaries[bound][btype] =
+				&halo->exposed[getRmaDisp(bound, btype, y)];
+		}
+	}
+
+	// With two processes both neighbors are the same one
+	numNeighbors = neighborIds[WB_TOP] == neighborIds[WB_BOTTOM]? 1 : 2;
+	MPI_Comm_group(MPI_COMM_WORLD, &worldGroup);
+	MPI_Group_incl(worldGroup, numNeighbors, neighborIds,
+		&halo->neighborGroup);
+	MPI_Group_free(&worldGroup);
+
+	return halo;
+}
+
+void freeRmaHalo(struct RmaHalo *halo)
+{
+	MPI_Group_free(&halo->neighborGroup);
+	MPI_Win_free(&halo->win);
+	free(halo);
+}
+
+/*
+ * Opens the epoch of this generation and puts the boundaries of each side,
+ * with their sizes, into the neighbor's received ones
+ */
+void rmaHalo_send(struct RmaHalo *halo)
+{
+	enum WorldBound opposite;
+	int bound, btype;
+
+	MPI_Win_post(halo->neighborGroup, 0, halo->win);
+	MPI_Win_start(halo->neighborGroup, 0, halo->win);
+
+	for (bound = WB_TOP; bound <= WB_BOTTOM; ++bound) {
+		opposite = OPPOSITE(bound);
+
+		for (btype = TO_REVIVE; btype <= TO_KILL; ++btype) {
+			MPI_Put(&halo->tx->boundariesSizes[bound][btype], 1,
+				MPI_WSIZE_T, halo->neighborIds[bound],
+				opposite*2 + btype, 1, MPI_WSIZE_T, halo->win);
+
+			MPI_Put(halo->tx->boundaries[bound][btype],
+				halo->tx->boundariesSizes[bound][btype],
+				MPI_WSIZE_T, halo->neighborIds[bound],
+				getRmaDisp(opposite, btype, halo->y),
+				halo->tx->boundariesSizes[bound][btype],
+				MPI_WSIZE_T, halo->win);
+		}
+	}
+
+	MPI_Win_complete(halo->win);
+}
+
+/*
+ * Waits for the neighbors to put their boundaries
+ */
+void rmaHalo_receive(struct RmaHalo *halo)
+{
+	int bound, btype;
+
+	MPI_Win_wait(halo->win);
+
+	for (bound = WB_TOP; bound <= WB_BOTTOM; ++bound) {
+		for (btype = TO_REVIVE; btype <= TO_KILL; ++btype) {
+			halo->rx->boundariesSizes[bound][btype] =
+				halo->exposed[bound*2 + btype];
+		}
+	}
+}
+
+inline static MPI_Aint getRmaDisp(enum WorldBound bound,
+	enum BoundaryType btype, wsize_t y)
+{
+	return 4 + (bound*2 + btype) * y;
+}
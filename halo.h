@@ -0,0 +1,33 @@
+#ifndef HALO_H_
+#define HALO_H_
+
+#include <stdbool.h>
+#include "world.h"
+
+enum Transport {
+	TRANSPORT_MSG,
+	TRANSPORT_SHM,
+	TRANSPORT_RMA
+};
+
+struct ShmHalo;
+struct RmaHalo;
+
+struct ShmHalo *createShmHalo(const int neighborIds[2], wsize_t y,
+	struct Boundary *tx, struct Boundary *rx);
+void freeShmHalo(struct ShmHalo *halo);
+
+bool shmHalo_isShared(enum WorldBound bound, const struct ShmHalo *halo);
+void shmHalo_publish(struct ShmHalo *halo);
+void shmHalo_receive(enum WorldBound bound, enum BoundaryType btype,
+	struct ShmHalo *halo);
+void shmHalo_next(struct ShmHalo *halo);
+
+struct RmaHalo *createRmaHalo(const int neighborIds[2], wsize_t y,
+	struct Boundary *tx, struct Boundary *rx);
+void freeRmaHalo(struct RmaHalo *halo);
+
+void rmaHalo_send(struct RmaHalo *halo);
+void rmaHalo_receive(struct RmaHalo *halo);
+
+#endif
@@ -7,8 +7,35 @@
 #include <time.h>
 #include "node.h"
 #include "stats.h"
+#include "cycle.h"
+#include "affinity.h"
+#include "pages.h"
+#include "halo.h"
+#include "batch.h"
+#include "snapshot.h"
+#include "small.h"
 #include <omp.h>
 
+// Options without short version
+enum LongOption {
+	OPT_CYCLES = 256,
+	OPT_AFFINITY,
+	OPT_HUGEPAGES,
+	OPT_HALO_DEPTH,
+	OPT_TRANSPORT,
+	OPT_RESORT,
+	OPT_RULE,
+	OPT_BATCH,
+	OPT_DENSITY,
+	OPT_DENSITY_EVERY,
+	OPT_RECORD_FORMAT,
+	OPT_RECORD_ROI,
+	OPT_RECORD_EVERY,
+	OPT_LOAD_SNAPSHOT,
+	OPT_SAVE_SNAPSHOT,
+	OPT_SMALL_WORLD
+};
+
 bool processArgs(struct Parameters *params, int argc, char *argv[]);
 void printHelp(char *argv[]);
 void poblateWorld(struct MPINode *node, struct Parameters *params);
@@ -20,22 +47,74 @@ int main(int argc, char *argv[])
 	struct MPINode *node;
 	struct Parameters params;
 	struct Stats *stats, *avgStats;
+	int threadSupport;
+	int ownId, numProc;
+	int status;
 
 	srand(time(NULL));
 
 	if(!processArgs(&params, argc, argv))
 		return EXIT_FAILURE;
 
-	MPI_Init(NULL, NULL);
+	// Only the master thread communicates, but in batch mode any thread
+	// takes the next job
+	MPI_Init_thread(NULL, NULL, params.batch? MPI_THREAD_SERIALIZED :
+		MPI_THREAD_FUNNELED, &threadSupport);
+
+	params.numThreads = setAffinity(params.affinity, params.numThreads);
+	setHugePages(params.hugePages);
+
+	if (params.batch) {
+		if (threadSupport < MPI_THREAD_SERIALIZED) {
+			MPI_Comm_rank(MPI_COMM_WORLD, &ownId);
+			if (ownId == 0) {
+				fprintf(stderr, "Batch mode needs an MPI "
+					"library with MPI_THREAD_SERIALIZED "
+					"support\n");
+			}
+			MPI_Finalize();
+			return EXIT_FAILURE;
+		}
+
+		status = runBatch(&params)? EXIT_SUCCESS : EXIT_FAILURE;
+		MPI_Finalize();
+		return status;
+	}
+
+	// Each process takes a strip of at least a row
+	MPI_Comm_size(MPI_COMM_WORLD, &numProc);
+	if (params.x < numProc) {
+		MPI_Comm_rank(MPI_COMM_WORLD, &ownId);
+		if (ownId == 0) {
+			fprintf(stderr, "The world has fewer rows than "
+				"processes\n");
+		}
+		MPI_Finalize();
+		return EXIT_FAILURE;
+	}
 
 	stats = createStats(params.iterations, params.numThreads);
 	avgStats = createStats(params.iterations, params.numThreads);
 	node = createNode(&params, stats);
 
-	poblateWorld(node, &params);
+	if (params.loadSnapshot) {
+		if (!node_loadSnapshot(params.loadSnapshot, node)) {
+			fprintf(stderr, "Can't load the snapshot '%s'\n",
+				params.loadSnapshot);
+			nodeAbort(node);
+		}
+	} else
+		poblateWorld(node, &params);
 
 	run(node);
 
+	if (params.saveSnapshot &&
+	    !node_saveSnapshot(params.saveSnapshot, node)) {
+		fprintf(stderr, "Can't save the snapshot '%s'\n",
+			params.saveSnapshot);
+		nodeAbort(node);
+	}
+
 	statsAvg(avgStats, node);
 	if (getNodeId(node) == 0) {
 		saveStats(avgStats);
@@ -86,6 +165,8 @@ void poblateWorld(struct MPINode *node, struct Parameters *params)
 bool processArgs(struct Parameters *params, int argc, char *argv[])
 {
 	static int record;
+	static int analytics;
+	static int persistent;
 
 	static struct option options[] =
 	{
@@ -94,6 +175,25 @@ bool processArgs(struct Parameters *params, int argc, char *argv[])
 		{"iterations", required_argument, NULL,    'i'},
 		{"cells",      required_argument, NULL,    'c'},
 		{"record",     no_argument,       &record,  1 },
+		{"analytics",  no_argument,       &analytics, 1 },
+		{"engine",     required_argument, NULL,    'e'},
+		{"cycles",     required_argument, NULL, OPT_CYCLES},
+		{"affinity",   required_argument, NULL, OPT_AFFINITY},
+		{"hugepages",  required_argument, NULL, OPT_HUGEPAGES},
+		{"halo-depth", required_argument, NULL, OPT_HALO_DEPTH},
+		{"transport",  required_argument, NULL, OPT_TRANSPORT},
+		{"resort",     required_argument, NULL, OPT_RESORT},
+		{"rule",       required_argument, NULL, OPT_RULE},
+		{"batch",      required_argument, NULL, OPT_BATCH},
+		{"density",    required_argument, NULL, OPT_DENSITY},
+		{"density-every", required_argument, NULL, OPT_DENSITY_EVERY},
+		{"record-format", required_argument, NULL, OPT_RECORD_FORMAT},
+		{"record-roi", required_argument, NULL, OPT_RECORD_ROI},
+		{"record-every", required_argument, NULL, OPT_RECORD_EVERY},
+		{"load-snapshot", required_argument, NULL, OPT_LOAD_SNAPSHOT},
+		{"save-snapshot", required_argument, NULL, OPT_SAVE_SNAPSHOT},
+		{"persistent", no_argument,       &persistent, 1 },
+		{"small-world", required_argument, NULL, OPT_SMALL_WORLD},
 		{0, 0, 0, 0}
 	};
 
@@ -101,15 +201,42 @@ bool processArgs(struct Parameters *params, int argc, char *argv[])
 	int opt;
 	char *x_char;
 	char *pEnd;
+	long long int sizeX = 0, sizeY = 0;
+	bool ruleSet = false;
+	bool engineSet = false, smallSet = false;
+	wsize_t corners[4];
+	int i;
+	struct SnapshotHeader header;
 
 	params->x = 0;
 	params->y = 0;
 	params->numThreads = -1;
 	params->iterations = 0;
 	params->cells = 0;
+	params->cycles = CYCLE_OFF;
+	params->engine = ENGINE_SPARSE;
+	params->affinity = AFFINITY_NONE;
+	params->hugePages = HUGEPAGES_NONE;
+	params->haloDepth = 1;
+	params->transport = TRANSPORT_MSG;
+	params->resort = 5;
+	params->smallCells = SMALL_CELLS;
+	params->rule = rule_B3S23;
+	params->batch = NULL;
+	params->densityRows = 0;
+	params->densityCols = 0;
+	params->densityEvery = 1;
+	params->recordFormat = RECORD_TEXT;
+	params->recordRegion.x0 = 0;
+	params->recordRegion.y0 = 0;
+	params->recordRegion.x1 = WSIZE_MAX;
+	params->recordRegion.y1 = WSIZE_MAX;
+	params->recordEvery = 1;
+	params->loadSnapshot = NULL;
+	params->saveSnapshot = NULL;
 
 	while(1) {
-		opt = getopt_long(argc, argv, "s:t:i:c:r", options, &optIdx);
+		opt = getopt_long(argc, argv, "s:t:i:c:re:", options, &optIdx);
 		if (opt == -1) break;
 
 		switch (opt) {
@@ -120,9 +247,9 @@ bool processArgs(struct Parameters *params, int argc, char *argv[])
 				if (x_char == NULL) goto error;
 				*x_char = ' ';
 
-				params->x = (wsize_t)strtol(optarg, &pEnd, 10);
+				sizeX = strtoll(optarg, &pEnd, 10);
 				if (errno == ERANGE) goto error;
-				params->y = (wsize_t)strtol(pEnd, NULL, 10);
+				sizeY = strtoll(pEnd, NULL, 10);
 				if (errno == ERANGE) goto error;
 				break;
 
@@ -147,6 +274,160 @@ bool processArgs(struct Parameters *params, int argc, char *argv[])
 			case 'r':
 				record = 1;
 				break;
+
+			case 'e':
+				if (strcmp(optarg, "sparse") == 0)
+					params->engine = ENGINE_SPARSE;
+				else if (strcmp(optarg, "dense") == 0)
+					params->engine = ENGINE_DENSE;
+				else if (strcmp(optarg, "ensemble") == 0)
+					params->engine = ENGINE_ENSEMBLE;
+				else
+					goto error;
+				engineSet = true;
+				break;
+
+			case OPT_CYCLES:
+				if (strcmp(optarg, "stop") == 0)
+					params->cycles = CYCLE_STOP;
+				else if (strcmp(optarg, "skip") == 0)
+					params->cycles = CYCLE_SKIP;
+				else
+					goto error;
+				break;
+
+			case OPT_AFFINITY:
+				if (strcmp(optarg, "none") == 0)
+					params->affinity = AFFINITY_NONE;
+				else if (strcmp(optarg, "compact") == 0)
+					params->affinity = AFFINITY_COMPACT;
+				else if (strcmp(optarg, "spread") == 0)
+					params->affinity = AFFINITY_SPREAD;
+				else if (strcmp(optarg, "socket") == 0)
+					params->affinity = AFFINITY_SOCKET;
+				else
+					goto error;
+				break;
+
+			case OPT_HUGEPAGES:
+				if (strcmp(optarg, "none") == 0)
+					params->hugePages = HUGEPAGES_NONE;
+				else if (strcmp(optarg, "thp") == 0)
+					params->hugePages = HUGEPAGES_THP;
+				else if (strcmp(optarg, "2m") == 0)
+					params->hugePages = HUGEPAGES_2M;
+				else if (strcmp(optarg, "1g") == 0)
+					params->hugePages = HUGEPAGES_1G;
+				else
+					goto error;
+				break;
+
+			case OPT_HALO_DEPTH:
+				params->haloDepth =
+					(wsize_t)strtol(optarg, NULL, 10);
+				if (errno == ERANGE || params->haloDepth < 1)
+					goto error;
+				break;
+
+			case OPT_TRANSPORT:
+				if (strcmp(optarg, "msg") == 0)
+					params->transport = TRANSPORT_MSG;
+				else if (strcmp(optarg, "shm") == 0)
+					params->transport = TRANSPORT_SHM;
+				else if (strcmp(optarg, "rma") == 0)
+					params->transport = TRANSPORT_RMA;
+				else
+					goto error;
+				break;
+
+			case OPT_RESORT:
+				params->resort =
+					(unsigned int)strtol(optarg, NULL, 10);
+				if (errno == ERANGE) goto error;
+				break;
+
+			case OPT_SMALL_WORLD:
+				params->smallCells =
+					(long long int)strtol(optarg, NULL, 10);
+				if (errno == ERANGE) goto error;
+				smallSet = true;
+				break;
+
+			case OPT_RULE:
+				if (!parseRule(optarg, &params->rule))
+					goto error;
+				ruleSet = true;
+				break;
+
+			case OPT_BATCH:
+				params->batch = optarg;
+				break;
+
+			case OPT_DENSITY:
+				x_char = strpbrk(optarg, "x");
+				if (x_char == NULL) goto error;
+				*x_char = ' ';
+
+				params->densityRows =
+					(wsize_t)strtol(optarg, &pEnd, 10);
+				if (errno == ERANGE) goto error;
+				params->densityCols =
+					(wsize_t)strtol(pEnd, NULL, 10);
+				if (errno == ERANGE) goto error;
+				if (params->densityRows < 1 ||
+				    params->densityCols < 1)
+					goto error;
+				break;
+
+			case OPT_DENSITY_EVERY:
+				params->densityEvery =
+					(unsigned int)strtol(optarg, NULL, 10);
+				if (errno == ERANGE || params->densityEvery < 1)
+					goto error;
+				break;
+
+			case OPT_RECORD_FORMAT:
+				if (strcmp(optarg, "text") == 0)
+					params->recordFormat = RECORD_TEXT;
+				else if (strcmp(optarg, "binary") == 0)
+					params->recordFormat = RECORD_BINARY;
+				else
+					goto error;
+				break;
+
+			case OPT_RECORD_ROI:
+				pEnd = optarg;
+				for (i = 0; i < 4; ++i) {
+					if (i && *pEnd++ != ',') goto error;
+					corners[i] = (wsize_t)strtol(pEnd, &pEnd, 10);
+					if (errno == ERANGE || corners[i] < 0)
+						goto error;
+				}
+				if (*pEnd != '\0' || corners[0] > corners[2] ||
+				    corners[1] > corners[3])
+					goto error;
+
+				params->recordRegion.x0 = corners[0];
+				params->recordRegion.y0 = corners[1];
+				params->recordRegion.x1 = corners[2];
+				params->recordRegion.y1 = corners[3];
+				break;
+
+			case OPT_RECORD_EVERY:
+				params->recordEvery =
+					(unsigned int)strtol(optarg, NULL, 10);
+				if (errno == ERANGE || params->recordEvery < 1)
+					goto error;
+				break;
+
+			case OPT_LOAD_SNAPSHOT:
+				params->loadSnapshot = optarg;
+				break;
+
+			case OPT_SAVE_SNAPSHOT:
+				params->saveSnapshot = optarg;
+				break;
+
 			case '?':
 			default:
 				goto error;
@@ -154,14 +435,64 @@ bool processArgs(struct Parameters *params, int argc, char *argv[])
 	}
 
 	params->record = record;
+	params->analytics = analytics;
+	params->persistent = persistent;
+
+	// An engine or mode asked for is measured as it is, unless the fast
+	// path is asked for too
+	if ((engineSet || persistent) && !smallSet)
+		params->smallCells = 0;
+
+	// The size and rule of the world are those of the snapshot, any other
+	// given is an error
+	if (params->loadSnapshot) {
+		if (!readSnapshotHeader(params->loadSnapshot, &header)) {
+			fprintf(stderr, "Can't read the snapshot '%s'\n",
+				params->loadSnapshot);
+			return false;
+		}
+		if ((sizeX || sizeY) && ((uint64_t)sizeX != header.x ||
+		    (uint64_t)sizeY != header.y)) {
+			fprintf(stderr, "The snapshot '%s' is of %llux%llu "
+				"cells\n", params->loadSnapshot,
+				(long long unsigned int)header.x,
+				(long long unsigned int)header.y);
+			return false;
+		}
+		if (ruleSet && (params->rule.birth != header.birth ||
+		    params->rule.survive != header.survive)) {
+			fprintf(stderr, "The snapshot '%s' was saved with "
+				"another rule\n", params->loadSnapshot);
+			return false;
+		}
+		sizeX = header.x;
+		sizeY = header.y;
+		params->rule.birth = header.birth;
+		params->rule.survive = header.survive;
+	}
 
-	if (params->numThreads == 0) params->numThreads = omp_get_max_threads();
+	if (sizeX > 0 && sizeY > 0 && !worldFits(sizeX, sizeY)) {
+		fprintf(stderr, "The world is too large for this build "
+			"(WSIZE_BITS=%d, WINDEX_BITS=%d)\n", WSIZE_BITS,
+			WINDEX_BITS);
+		return false;
+	}
+	params->x = sizeX;
+	params->y = sizeY;
 
 	if (
-		params->x == 0 ||
-		params->y == 0 ||
 		params->numThreads == -1 ||
-		params->iterations == 0
+		(params->batch == NULL && (
+			params->x == 0 ||
+			params->y == 0 ||
+			params->iterations == 0 ||
+			params->engine == ENGINE_ENSEMBLE
+		)) ||
+		(params->analytics && params->engine != ENGINE_SPARSE) ||
+		(params->batch == NULL && (
+			params->recordRegion.x0 >= params->x ||
+			params->recordRegion.y0 >= params->y
+		))
 	)
 		goto error;
 
@@ -179,7 +510,26 @@ void printHelp(char *argv[])
 		"--threads <number> "
 		"--iterations <number> "
 		"[--cells <number>] "
-		"[--record]"
+		"[--record] "
+		"[--analytics] "
+		"[--engine <sparse|dense|ensemble>] "
+		"[--cycles <stop|skip>] "
+		"[--affinity <none|compact|spread|socket>] "
+		"[--hugepages <none|thp|2m|1g>] "
+		"[--halo-depth <rows>] "
+		"[--transport <msg|shm|rma>] "
+		"[--resort <generations>] "
+		"[--rule <B.../S...>] "
+		"[--batch <job file>] "
+		"[--density <rows>x<columns>] "
+		"[--density-every <generations>] "
+		"[--record-format <text|binary>] "
+		"[--record-roi <x0>,<y0>,<x1>,<y1>] "
+		"[--record-every <generations>] "
+		"[--load-snapshot <file>] "
+		"[--save-snapshot <file>] "
+		"[--persistent] "
+		"[--small-world <cells>]"
 		"\n",
 		argv[0]
 	);
@@ -198,4 +548,61 @@ void printHelp(char *argv[])
 
 	fprintf(stderr, "\t-r, --record\n");
 	fprintf(stderr, "\t\tSave each iterations. CAUTION: Do not use with bigs worlds\n\n");
+
+	fprintf(stderr, "\t--analytics\n");
+	fprintf(stderr, "\t\tWith the sparse engine, save the population, births, deaths, active tiles and bounding box of each generation to 'analytics.data'\n\n");
+
+	fprintf(stderr, "\t-e, --engine <sparse|dense|ensemble>\n");
+	fprintf(stderr, "\t\tWorld representation. 'sparse' (default) only processes the cells near alive ones, 'dense' steps the whole world between two buffers, 'ensemble' steps up to 64 worlds of a batch at once, one per bit\n\n");
+
+	fprintf(stderr, "\t--cycles <stop|skip>\n");
+	fprintf(stderr, "\t\tDetect when the world repeats a previous state (periods up to %d). Then stop the run or skip the remaining whole periods\n\n", CYCLE_MAX_PERIOD);
+
+	fprintf(stderr, "\t--affinity <none|compact|spread|socket>\n");
+	fprintf(stderr, "\t\tPin each thread to a CPU: consecutive ones, spread over the allowed CPUs, or one socket per process of the host (with -t0 a thread per CPU of the socket)\n\n");
+
+	fprintf(stderr, "\t--hugepages <none|thp|2m|1g>\n");
+	fprintf(stderr, "\t\tBack the world with transparent or explicit huge pages. It falls back to smaller pages when they can't be reserved\n\n");
+
+	fprintf(stderr, "\t--halo-depth <rows>\n");
+	fprintf(stderr, "\t\tWith the dense engine, exchange this number of rows with the neighbor processes every that many generations, computing the overlap twice (default 1)\n\n");
+
+	fprintf(stderr, "\t--transport <msg|shm|rma>\n");
+	fprintf(stderr, "\t\tHow the sparse engine exchanges the limits: 'msg' (default) sends messages, 'shm' shares them in memory with the processes of the same host, and sends messages to the rest, 'rma' puts them into the windows of the neighbors\n\n");
+
+	fprintf(stderr, "\t--resort <generations>\n");
+	fprintf(stderr, "\t\tWith the sparse engine, move the cells in memory to the order they are checked every that many generations, 0 never does (default 5)\n\n");
+
+	fprintf(stderr, "\t--rule <B.../S...>\n");
+	fprintf(stderr, "\t\tNeighbor counts for a cell to be born and to survive (default B3/S23). B3/S23, B36/S23, B3678/S34678 and B2/S have specialized kernels\n\n");
+
+	fprintf(stderr, "\t--batch <job file>\n");
+	fprintf(stderr, "\t\tRun the worlds of the file, a line '<x size>x<y size> <cells> <iterations> [<rule>] [<seed>]' each, spread over the threads of all the processes. The size, iterations and cells options are not needed, the results are saved to 'batch.data'\n\n");
+
+	fprintf(stderr, "\t--density <rows>x<columns>\n");
+	fprintf(stderr, "\t\tSave a map of this size with the density of alive cells of each block of the world to 'density/', as PGM images (Ex: --density 1024x1024)\n\n");
+
+	fprintf(stderr, "\t--density-every <generations>\n");
+	fprintf(stderr, "\t\tGenerations between density maps (default 1)\n\n");
+
+	fprintf(stderr, "\t--record-format <text|binary>\n");
+	fprintf(stderr, "\t\tWith --record, save each generation as text files in 'node<id>/' (default) or as frames of a single 'record.bin', a bit per cell, that 'viewer' replays\n\n");
+
+	fprintf(stderr, "\t--record-roi <x0>,<y0>,<x1>,<y1>\n");
+	fprintf(stderr, "\t\tWith --record, save only the cells from the row x0 and column y0 to the row x1 and column y1, both included. Only the processes with rows in the region write them\n\n");
+
+	fprintf(stderr, "\t--record-every <generations>\n");
+	fprintf(stderr, "\t\tGenerations between recorded ones (default 1)\n\n");
+
+	fprintf(stderr, "\t--load-snapshot <file>\n");
+	fprintf(stderr, "\t\tStart from a snapshot instead of random cells, with its size and rule, which -s and --rule can't change. Each process maps only its rows of the file\n\n");
+
+	fprintf(stderr, "\t--save-snapshot <file>\n");
+	fprintf(stderr, "\t\tSave the world after the last generation as a snapshot, a bit per cell\n\n");
+
+	fprintf(stderr, "\t--persistent\n");
+	fprintf(stderr, "\t\tKeep a single team of threads for the whole run, synchronized with barriers between the phases of each generation, instead of starting one per generation\n\n");
+
+	fprintf(stderr, "\t--small-world <cells>\n");
+	fprintf(stderr, "\t\tLargest world run with a single process in the fast path, a bit per cell in a single thread, between the generations with outputs, without analytics or cycle detection. 0 disables it, and so do -e and --persistent unless this is given too (default %d)\n\n", SMALL_CELLS);
 }
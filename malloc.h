@@ -17,4 +17,16 @@ inline static void *mallocC(size_t size)
 	return ptr;
 }
 
+inline static void *reallocC(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+
+	if (!ptr) {
+		fprintf(stderr, "Can't reserve memory\n");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	return ptr;
+}
+
 #endif
@@ -1,85 +1,259 @@
 #include "node.h"
 #include "gol.h"
+#include "dense.h"
 #include "io.h"
 #include "stats.h"
+#include "cycle.h"
+#include "halo.h"
+#include "analytics.h"
+#include "density.h"
+#include "record.h"
+#include "snapshot.h"
+#include "barrier.h"
+#include "small.h"
 #include "malloc.h"
 #include <omp.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
 
 #define MAX_FILENAME 10
 
+// Boundaries are tagged with the side of the sender they come from
+#define BOUND_TAG(bound, btype) ((bound)*2 + (btype))
+// Full rows of the dense engine are tagged with the side they are sent to
+#define ROW_TAG(bound) (4 + (bound))
+// Fewer generations without outputs are not worth packing the world
+#define MIN_BURST 16
+
 struct MPINode {
 	struct World *world;
 	struct GOL *gol;
+	struct Dense *dense;
+	struct Small *small;
 	struct Stats *stats;
 	const struct Parameters *params;
 	int numProc;
 	int ownId;
 	int neighborIds[2];
+	// Rows of the whole world, and first of the strip of this process
+	wsize_t totalX;
+	wsize_t xOffset;
 
 	struct Boundary *RXboundary;
 	struct Boundary *TXboundary;
+	struct ShmHalo *shmHalo;
+	struct RmaHalo *rmaHalo;
+	// Communication overlapped with the generation, when MPI allows it
+	struct Exchange exchange;
+	struct Exchange rowExchange;
+	MPI_Request rowRequests[4];
+	bool overlap;
+	double subItTime;
+
+	struct CycleDetector *cycleDetector;
+	struct Analytics *analytics;
+	struct DensityMap *densityMap;
+	struct Recording *recording;
+	struct Region recordRegion;
 
 	long long unsigned int itCounter;
+	// Generation of the loaded snapshot that the counter starts after
+	long long unsigned int firstGeneration;
 	char dirName[MAX_FILENAME];
 };
 
+static void runLoop(struct MPINode *node);
+static void runPersistent(struct MPINode *node);
+static void runSmall(struct MPINode *node);
+static unsigned long long int nextOutput(const struct MPINode *node);
+static void runBurst(unsigned long long int generations,
+	struct MPINode *node);
+static void setChanges(struct MPINode *node);
+static bool endGeneration(struct MPINode *node);
 static void iterate(struct MPINode *node);
+static void prepareIteration(struct MPINode *node);
+static void stepIteration(struct MPINode *node);
+static void finishIteration(struct MPINode *node);
 static bool receiveBound(enum WorldBound bound, enum BoundaryType btype,
 	struct MPINode *node);
 static bool sendBound(enum WorldBound bound, enum BoundaryType btype,
 	struct MPINode *node);
-static void receiveBounds(struct MPINode *node);
+static void receiveBounds(enum WorldBound bound, struct MPINode *node);
 static void sendBounds(struct MPINode *node);
+static void sendHalo(void *data);
+static void receiveHalo(enum WorldBound bound, void *data);
+static void sendRows(void *data);
+static void receiveRows(enum WorldBound bound, void *data);
 static void treadIOError(struct MPINode *node);
+static bool checkCycles(struct MPINode *node);
+static bool writeDensity(struct MPINode *node);
+static bool writeFrame(struct MPINode *node);
+static bool isAlive(wsize_t x, wsize_t y, struct MPINode *node);
 
 struct MPINode *createNode(const struct Parameters *params, struct Stats *stats)
 {
 	struct MPINode *node;
-	wsize_t x, y;
+	wsize_t x, y, minX, rest;
+	wsize_t halo;
+	int threadSupport;
 
 	node = (struct MPINode *)mallocC(sizeof(struct MPINode));
 
 	MPI_Comm_size(MPI_COMM_WORLD, &node->numProc);
 	MPI_Comm_rank(MPI_COMM_WORLD, &node->ownId);
 
-	x = (params->x/(double)node->numProc) + 0.5;
+	// The first processes take a row more when the rows aren't divisible
+	x = params->x / node->numProc;
 	y = params->y;
+	rest = params->x % node->numProc;
+	minX = x;
+	node->totalX = params->x;
+	node->xOffset = node->ownId * x +
+		(node->ownId < rest? (wsize_t)node->ownId : rest);
+	if (node->ownId < rest) ++x;
 
 	if (node->numProc > 1) {
 		node->neighborIds[WB_TOP] =
 			node->ownId? node->ownId - 1 : node->numProc - 1;
 		node->neighborIds[WB_BOTTOM] =(node->ownId + 1) % node->numProc;
-
-		node->world = createWorld(x, y, true);
-
-		getBoundaries(&node->TXboundary, &node->RXboundary,node->world);
-	} else
-		node->world = createWorld(params->x, params->y, false);
+	}
 
 	node->itCounter = 0;
+	node->firstGeneration = 0;
+	node->shmHalo = NULL;
+	node->rmaHalo = NULL;
+	node->exchange.send = sendHalo;
+	node->exchange.receive = receiveHalo;
+	node->exchange.data = node;
+	node->rowExchange.send = sendRows;
+	node->rowExchange.receive = receiveRows;
+	node->rowExchange.data = node;
+
+	// Only the master thread communicates, while the rest step the world
+	MPI_Query_thread(&threadSupport);
+	node->overlap = threadSupport >= MPI_THREAD_FUNNELED;
+	if (!node->overlap && node->numProc > 1 && node->ownId == 0) {
+		fprintf(stderr, "MPI without thread support, "
+			"communication is not overlapped\n");
+	}
 	node->params = params;
 	node->stats = stats;
+	node->cycleDetector = params->cycles != CYCLE_OFF?
+		createCycleDetector() : NULL;
+	node->analytics = params->analytics? createAnalytics() : NULL;
 
 	snprintf(node->dirName, MAX_FILENAME, "node%d", node->ownId);
 	if (!createSubdir(node->dirName)) treadIOError(node);
 
-	node->gol = golInit(params->numThreads, &rule_B3S23, node->world,stats);
+	node->densityMap = NULL;
+	if (params->densityRows) {
+		node->densityMap = createDensityMap(params->densityRows,
+			params->densityCols, x, y, node->xOffset,
+			node->totalX, "density");
+		if (node->ownId == 0 && !createSubdir("density"))
+			treadIOError(node);
+	}
+
+	// Recorded region, inside the world
+	node->recordRegion = params->recordRegion;
+	if (node->recordRegion.x1 > node->totalX - 1)
+		node->recordRegion.x1 = node->totalX - 1;
+	if (node->recordRegion.y1 > y - 1)
+		node->recordRegion.y1 = y - 1;
+	if (node->recordRegion.x0 > node->recordRegion.x1)
+		node->recordRegion.x0 = node->recordRegion.x1;
+
+	node->recording = NULL;
+	if (params->record && params->recordFormat == RECORD_BINARY) {
+		node->recording = createRecording("record.bin", x,
+			node->xOffset, &node->recordRegion, &params->rule);
+		if (!node->recording) treadIOError(node);
+	}
+
+	if (params->engine == ENGINE_DENSE) {
+		// The neighbors can't send more rows than they have
+		halo = params->haloDepth;
+		if (halo > minX) {
+			if (node->ownId == 0) {
+				fprintf(stderr, "Halo depth reduced to %ld\n",
+					(long int)minX);
+			}
+			halo = minX;
+		}
+
+		node->world = NULL;
+		node->gol = NULL;
+		node->dense = createDense(x, y, node->numProc > 1, halo,
+			params->numThreads, &params->rule, stats);
+		setDenseOffset(node->xOffset, node->dense);
+		setDenseHashing(params->cycles != CYCLE_OFF, node->dense);
+	} else {
+		node->dense = NULL;
+		node->world = createWorld(x, y, node->numProc > 1);
+		setWorldOffset(node->xOffset, node->world);
+
+		if (node->numProc > 1) {
+			getBoundaries(&node->TXboundary, &node->RXboundary,
+				node->world);
+
+			if (params->transport == TRANSPORT_SHM) {
+				node->shmHalo = createShmHalo(node->neighborIds,
+					y, node->TXboundary, node->RXboundary);
+			} else if (params->transport == TRANSPORT_RMA) {
+				node->rmaHalo = createRmaHalo(node->neighborIds,
+					y, node->TXboundary, node->RXboundary);
+			}
+		}
+
+		node->gol = golInit(params->numThreads, &params->rule,
+			node->world, stats);
+		setResortPeriod(params->resort, node->gol);
+	}
+
+	// Small worlds of a single process run in the fast path between the
+	// generations with outputs, unless every generation is examined
+	node->small = NULL;
+	if (node->numProc == 1 &&
+	    (unsigned long long int)(x * y) <= params->smallCells &&
+	    !params->analytics && params->cycles == CYCLE_OFF) {
+		node->small = createSmall(x, y, &params->rule, stats);
+		if (params->numThreads > 1) {
+			fprintf(stderr, "The world runs in the small world "
+				"fast path, in a single thread "
+				"('--small-world 0' disables it)\n");
+		}
+	}
 
 	return node;
 }
 
 void deleteNode(struct MPINode *node)
 {
-	destroyWorld(node->world);
-	golEnd(node->gol);
+	if (node->dense) {
+		destroyDense(node->dense);
+	} else {
+		destroyWorld(node->world);
+		golEnd(node->gol);
+	}
+	if (node->small) destroySmall(node->small);
+	if (node->cycleDetector) freeCycleDetector(node->cycleDetector);
+	if (node->analytics) freeAnalytics(node->analytics);
+	if (node->densityMap) freeDensityMap(node->densityMap);
+	if (node->recording) freeRecording(node->recording);
+	if (node->shmHalo) freeShmHalo(node->shmHalo);
+	if (node->rmaHalo) freeRmaHalo(node->rmaHalo);
 	free(node);
 }
 
 inline void nodeAbort(struct MPINode *node)
 {
-	if (node) deleteNode(node);
+	if (node) {
+		// Freeing the windows is collective, let the abort release them
+		node->shmHalo = NULL;
+		node->rmaHalo = NULL;
+		deleteNode(node);
+	}
 	MPI_Abort(MPI_COMM_WORLD, -1);
 }
 
@@ -87,20 +261,29 @@ inline static bool receiveBound(enum WorldBound bound, enum BoundaryType btype,
 	struct MPINode *node)
 {
 	int err;
+	int count;
 	MPI_Status status;
 
+	if (node->shmHalo && shmHalo_isShared(bound, node->shmHalo)) {
+		shmHalo_receive(bound, btype, node->shmHalo);
+		return true;
+	}
+
+	// Already put by the neighbor
+	if (node->rmaHalo) return true;
+
 	err = MPI_Recv(
 		node->RXboundary->boundaries[bound][btype],
 		boundaryMaxSize,
 		MPI_WSIZE_T,
 		node->neighborIds[bound],
-		node->ownId,
+		BOUND_TAG(OPPOSITE(bound), btype),
 		MPI_COMM_WORLD,
 		&status
 	);
 
-	MPI_Get_count(&status, MPI_WSIZE_T,
-		(int *)&(node->RXboundary->boundariesSizes[bound][btype]));
+	MPI_Get_count(&status, MPI_WSIZE_T, &count);
+	node->RXboundary->boundariesSizes[bound][btype] = count;
 
 	return err == MPI_SUCCESS;
 }
@@ -110,32 +293,42 @@ inline static bool sendBound(enum WorldBound bound, enum BoundaryType btype,
 {
 	int err;
 
+	// Neighbors in the same host read it from the shared window
+	if (node->shmHalo && shmHalo_isShared(bound, node->shmHalo))
+		return true;
+
+	// Put into the neighbor's window for all the boundaries at once
+	if (node->rmaHalo) return true;
+
 	err = MPI_Send(
 		node->TXboundary->boundaries[bound][btype],
 		node->TXboundary->boundariesSizes[bound][btype],
 		MPI_WSIZE_T,
 		node->neighborIds[bound],
-		node->neighborIds[bound],
+		BOUND_TAG(bound, btype),
 		MPI_COMM_WORLD
 	);
 
 	return err;
 }
 
-inline static void receiveBounds(struct MPINode *node)
+/*
+ * Receives and sets the boundaries of a side. The top side goes first.
+ */
+inline static void receiveBounds(enum WorldBound bound, struct MPINode *node)
 {
-	// Receive boundaries
-	receiveBound(WB_TOP,    TO_REVIVE, node);
-	setBoundary(WB_TOP,     TO_REVIVE, node->world);
+	if (bound == WB_TOP && node->rmaHalo) rmaHalo_receive(node->rmaHalo);
 
-	receiveBound(WB_BOTTOM, TO_REVIVE, node);
-	setBoundary(WB_BOTTOM,  TO_REVIVE, node->world);
+	receiveBound(bound, TO_REVIVE, node);
+	setBoundary(bound,  TO_REVIVE, node->world);
 
-	receiveBound(WB_TOP,    TO_KILL,   node);
-	setBoundary(WB_TOP,     TO_KILL, node->world);
+	receiveBound(bound, TO_KILL,   node);
+	setBoundary(bound,  TO_KILL,   node->world);
 
-	receiveBound(WB_BOTTOM, TO_KILL,   node);
-	setBoundary(WB_BOTTOM,  TO_KILL, node->world);
+	if (bound == WB_BOTTOM) {
+		if (node->shmHalo) shmHalo_next(node->shmHalo);
+		clearBoundary(node->RXboundary);
+	}
 }
 
 inline static void sendBounds(struct MPINode *node)
@@ -145,14 +338,61 @@ inline static void sendBounds(struct MPINode *node)
 	sendBound(WB_BOTTOM, TO_REVIVE, node);
 	sendBound(WB_TOP,    TO_KILL,   node);
 	sendBound(WB_BOTTOM, TO_KILL,   node);
+
+	if (node->shmHalo) shmHalo_publish(node->shmHalo);
+	if (node->rmaHalo) rmaHalo_send(node->rmaHalo);
+
+	clearBoundary(node->TXboundary);
+}
+
+static void sendHalo(void *data)
+{
+	struct MPINode *node = (struct MPINode *)data;
+	double commTime;
+
+	commTime = startMeasurement();
+	sendBounds(node);
+	endMeasurement(commTime, communication, node->stats);
+}
+
+static void receiveHalo(enum WorldBound bound, void *data)
+{
+	struct MPINode *node = (struct MPINode *)data;
+	double commTime;
+
+	commTime = startMeasurement();
+	receiveBounds(bound, node);
+	endMeasurement(commTime, communication, node->stats);
 }
 
 void run(struct MPINode *node)
 {
-	double pTime, itTime;
+	double pTime;
 
+	startCounters(node->stats);
 	pTime = omp_get_wtime();
 
+	if (node->small)
+		runSmall(node);
+	else if (node->params->persistent)
+		runPersistent(node);
+	else
+		runLoop(node);
+
+	node->stats->total = omp_get_wtime() - pTime;
+	endCounters(node->stats);
+
+	if (node->analytics && !saveAnalytics(node->analytics))
+		treadIOError(node);
+}
+
+/*
+ * Each generation starts a team of threads, that ends with it
+ */
+static void runLoop(struct MPINode *node)
+{
+	double itTime;
+
 	for (
 		node->itCounter = 0;
 		node->itCounter <= node->params->iterations;
@@ -164,31 +404,361 @@ void run(struct MPINode *node)
 
 		endMeasurement(itTime, mpiIteration, node->stats);
 
-		if (node->params->record && !write(node)) treadIOError(node);
+		if (!endGeneration(node)) break;
 	}
+}
 
-	node->stats->total = omp_get_wtime() - pTime;
+/*
+ * The same loop in a single parallel region. The master thread runs the parts
+ * of each generation for a single thread, including the communication, and
+ * the team waits for it in barriers instead of being started again.
+ */
+static void runPersistent(struct MPINode *node)
+{
+	struct Barrier barrier;
+	bool running = true;
+	double itTime = 0.0;
+
+	node->itCounter = 0;
+
+	#pragma omp parallel shared(barrier, running, itTime)
+	{
+		bool sense = false;
+
+		#pragma omp single
+		initBarrier(omp_get_num_threads(), &barrier);
+
+		for (;;) {
+			#pragma omp master
+			{
+				running = running &&
+					node->itCounter <= node->params->iterations;
+				if (running) {
+					itTime = startMeasurement();
+					prepareIteration(node);
+				}
+			}
+			barrier_wait(&sense, &barrier);
+			if (!running) break;
+
+			stepIteration(node);
+			barrier_wait(&sense, &barrier);
+
+			#pragma omp master
+			{
+				finishIteration(node);
+				endMeasurement(itTime, mpiIteration, node->stats);
+
+				if (endGeneration(node))
+					++(node->itCounter);
+				else
+					running = false;
+			}
+		}
+	}
+}
+
+/*
+ * The generations with outputs are computed by the engine, and the ones
+ * between them in bursts of the fast path. The first one is too, as it sets
+ * the initial cells.
+ */
+static void runSmall(struct MPINode *node)
+{
+	unsigned long long int next;
+	double itTime;
+
+	node->itCounter = 0;
+	for (;;) {
+		itTime = startMeasurement();
+		iterate(node);
+		endMeasurement(itTime, mpiIteration, node->stats);
+
+		if (!endGeneration(node) ||
+		    ++(node->itCounter) > node->params->iterations)
+			break;
+
+		next = nextOutput(node);
+		if (next - node->itCounter >= MIN_BURST) {
+			itTime = startMeasurement();
+			runBurst(next - node->itCounter, node);
+			endMeasurement(itTime, mpiIteration, node->stats);
+			node->itCounter = next;
+		}
+	}
 }
 
+/*
+ * First generation from the counter on with outputs, or the last one
+ */
+static unsigned long long int nextOutput(const struct MPINode *node)
+{
+	const struct Parameters *params = node->params;
+	unsigned long long int next = params->iterations;
+	unsigned long long int output;
+
+	if (params->record) {
+		output = (node->itCounter + params->recordEvery - 1) /
+			params->recordEvery * params->recordEvery;
+		if (output < next) next = output;
+	}
+
+	if (node->densityMap) {
+		output = (node->itCounter + params->densityEvery - 1) /
+			params->densityEvery * params->densityEvery;
+		if (output < next) next = output;
+	}
+
+	return next;
+}
+
+/*
+ * Packs the world of the engine, runs the generations and unpacks it back
+ */
+static void runBurst(unsigned long long int generations,
+	struct MPINode *node)
+{
+	struct PackedRows *rows = small_getRows(node->small);
+
+	node->subItTime = startMeasurement();
+
+	memset(rows->rows, 0, rows->x1 * rows->rowBytes);
+	if (node->dense)
+		dense_packWorld(rows, node->dense);
+	else
+		packWorld(rows, node->world);
+
+	small_run(generations, node->small);
+
+	if (node->dense)
+		dense_unpackWorld(rows, node->dense);
+	else
+		setChanges(node);
+
+	endMeasurement(node->subItTime, ompIteration, node->stats);
+}
+
+/*
+ * The sparse engine only gets the cells that changed in the burst, which are
+ * set before its next generation
+ */
+static void setChanges(struct MPINode *node)
+{
+	const struct PackedRows *start = small_getStart(node->small);
+	const struct PackedRows *rows = small_getRows(node->small);
+	const uint64_t *before, *after;
+	uint64_t changed;
+	size_t words = rows->rowBytes / sizeof(uint64_t);
+	size_t w;
+	wsize_t i, j;
+
+	for (i = rows->x0; i < rows->x1; ++i) {
+		before = (const uint64_t *)&start->rows[i * start->rowBytes];
+		after = (const uint64_t *)&rows->rows[i * rows->rowBytes];
+
+		for (w = 0; w < words; ++w) {
+			for (changed = before[w] ^ after[w]; changed;
+			     changed &= changed - 1) {
+				j = w * 64 + __builtin_ctzll(changed);
+				if ((after[w] >> (j % 64)) & 1)
+					gol_reviveCell(i, j, node->gol);
+				else
+					gol_killCell(i, j, node->gol);
+			}
+		}
+	}
+}
+
+/*
+ * Outputs of the generation just computed. Returns false when the run must
+ * stop.
+ */
+static bool endGeneration(struct MPINode *node)
+{
+	struct Census census;
+
+	if (node->params->record &&
+	    node->itCounter % node->params->recordEvery == 0 &&
+	    !(node->recording? writeFrame(node) : node_write(node)))
+		treadIOError(node);
+
+	if (node->analytics) {
+		getCensus(&census, node->world);
+		addCensus(node->firstGeneration + node->itCounter, &census,
+			node->analytics);
+	}
+
+	if (node->densityMap &&
+	    node->itCounter % node->params->densityEvery == 0 &&
+	    !writeDensity(node))
+		treadIOError(node);
+
+	return !(node->cycleDetector && checkCycles(node));
+}
+
+/*
+ * A generation is prepared and finished by a single thread, and stepped by a
+ * team of threads in between
+ */
 inline static void iterate(struct MPINode *node)
 {
-	double subItTime, commTime;
+	prepareIteration(node);
+
+	#pragma omp parallel
+	stepIteration(node);
+
+	finishIteration(node);
+}
+
+static void prepareIteration(struct MPINode *node)
+{
+	const struct Exchange *exchange = NULL;
+
+	if (node->dense) {
+		if (node->numProc > 1) {
+			if (node->overlap) {
+				exchange = &node->rowExchange;
+			} else if (dense_haloExpired(node->dense)) {
+				sendRows(node);
+				receiveRows(WB_TOP, node);
+				receiveRows(WB_BOTTOM, node);
+			}
+		}
+
+		node->subItTime = startMeasurement();
+		dense_prepare(node->dense, exchange);
+		return;
+	}
 
 	if (node->numProc > 1) {
-		commTime = startMeasurement();
+		if (node->overlap) {
+			exchange = &node->exchange;
+		} else {
+			sendHalo(node);
+			receiveHalo(WB_TOP, node);
+			receiveHalo(WB_BOTTOM, node);
+		}
+	}
+
+	node->subItTime = startMeasurement();
+	gol_prepare(node->gol, exchange);
+}
 
-		sendBounds(node);
-		receiveBounds(node);
-		clearBoundaries(node->world);
+inline static void stepIteration(struct MPINode *node)
+{
+	if (node->dense)
+		dense_step(node->dense);
+	else
+		gol_check(node->gol);
+}
 
-		endMeasurement(commTime, communication, node->stats);
+inline static void finishIteration(struct MPINode *node)
+{
+	if (node->dense)
+		dense_finish(node->dense);
+	else
+		gol_update(node->gol);
+
+	endMeasurement(node->subItTime, ompIteration, node->stats);
+}
+
+/*
+ * The first rows are sent to the top neighbor and the last ones to the bottom
+ * neighbor, while their rows are received into the ghost rows. With a halo of
+ * k rows, this is done every k generations.
+ */
+static void sendRows(void *data)
+{
+	struct MPINode *node = (struct MPINode *)data;
+	wsize_t x, y;
+	wsize_t halo;
+	size_t size;
+	unsigned char *rows;
+	double commTime;
+
+	commTime = startMeasurement();
+
+	dense_getSize(&x, &y, node->dense);
+	halo = dense_getHalo(node->dense);
+
+	rows = dense_getHaloRows(-halo, &size, node->dense);
+	MPI_Irecv(rows, size, MPI_UNSIGNED_CHAR, node->neighborIds[WB_TOP],
+		ROW_TAG(WB_BOTTOM), MPI_COMM_WORLD,
+		&node->rowRequests[WB_TOP]);
+	rows = dense_getHaloRows(x, &size, node->dense);
+	MPI_Irecv(rows, size, MPI_UNSIGNED_CHAR, node->neighborIds[WB_BOTTOM],
+		ROW_TAG(WB_TOP), MPI_COMM_WORLD,
+		&node->rowRequests[WB_BOTTOM]);
+
+	rows = dense_getHaloRows(0, &size, node->dense);
+	MPI_Isend(rows, size, MPI_UNSIGNED_CHAR, node->neighborIds[WB_TOP],
+		ROW_TAG(WB_TOP), MPI_COMM_WORLD,
+		&node->rowRequests[2 + WB_TOP]);
+	rows = dense_getHaloRows(x - halo, &size, node->dense);
+	MPI_Isend(rows, size, MPI_UNSIGNED_CHAR, node->neighborIds[WB_BOTTOM],
+		ROW_TAG(WB_BOTTOM), MPI_COMM_WORLD,
+		&node->rowRequests[2 + WB_BOTTOM]);
+
+	endMeasurement(commTime, communication, node->stats);
+}
+
+/*
+ * Waits for the ghost rows of a side. The rows sent are not changed until the
+ * bottom side is received.
+ */
+static void receiveRows(enum WorldBound bound, void *data)
+{
+	struct MPINode *node = (struct MPINode *)data;
+	double commTime;
+
+	commTime = startMeasurement();
+
+	MPI_Wait(&node->rowRequests[bound], MPI_STATUS_IGNORE);
+	if (bound == WB_BOTTOM)
+		MPI_Waitall(2, &node->rowRequests[2], MPI_STATUSES_IGNORE);
+
+	endMeasurement(commTime, communication, node->stats);
+}
+
+/*
+ * Looks for the global state of the world in the last generations. When a
+ * cycle is found, returns true if the run must be stopped or jumps the
+ * iteration counter over the remaining whole periods.
+ */
+static bool checkCycles(struct MPINode *node)
+{
+	uint64_t hash;
+	unsigned int period;
+	long long unsigned int remaining;
+
+	hash = node->dense?
+		getDenseHash(node->dense) : getWorldHash(node->world);
+	if (node->numProc > 1) {
+		MPI_Allreduce(MPI_IN_PLACE, &hash, 1, MPI_UINT64_T, MPI_BXOR,
+			MPI_COMM_WORLD);
 	}
 
-	subItTime = startMeasurement();
+	period = checkCycle(hash, node->cycleDetector);
+	if (period == 0) return false;
+
+	if (node->ownId == 0) {
+		printf("Cycle of period %u detected at generation %Lu\n",
+			period, node->firstGeneration + node->itCounter);
+	}
+
+	freeCycleDetector(node->cycleDetector);
+	node->cycleDetector = NULL;
+
+	if (node->params->cycles == CYCLE_STOP) return true;
+
+	remaining = node->params->iterations - node->itCounter;
+	node->itCounter += remaining / period * period;
 
-	iteration(node->gol);
+	if (node->ownId == 0)
+		printf("Skipped to generation %Lu\n",
+			node->firstGeneration + node->itCounter);
 
-	endMeasurement(subItTime, ompIteration, node->stats);
+	return false;
 }
 
 inline static void treadIOError(struct MPINode *node)
@@ -204,41 +774,67 @@ inline static void treadIOError(struct MPINode *node)
 
 inline void node_reviveCell(wsize_t x, wsize_t y, struct MPINode *node)
 {
-	gol_reviveCell(x, y, node->gol);
+	if (node->dense)
+		dense_reviveCell(x, y, node->dense);
+	else
+		gol_reviveCell(x, y, node->gol);
 }
 
 inline void node_killCell(wsize_t x, wsize_t y, struct MPINode *node)
 {
-	gol_killCell(x, y, node->gol);
+	if (node->dense)
+		dense_killCell(x, y, node->dense);
+	else
+		gol_killCell(x, y, node->gol);
 }
 
-bool write(struct MPINode *node)
+inline static bool isAlive(wsize_t x, wsize_t y, struct MPINode *node)
+{
+	struct Cell *cell;
+
+	if (node->dense)
+		return dense_isCellAlive(x, y, node->dense);
+
+	cell = getCell(x, y, node->world);
+	return cell != NULL && isCellAlive(cell);
+}
+
+bool node_write(struct MPINode *node)
 {
 	char filename[MAX_FILENAME];
 	bool alive;
 	bool ret;
 	wsize_t x, y;
 	wsize_t i, j;
+	wsize_t first, last;
+	const struct Region *region = &node->recordRegion;
 	char *buffer, *pBuffer;
 	size_t buffSize;
 
-	getSize(&x, &y, node->world);
-	buffSize = x*(y*2 + 1) + 2;
+	if (node->dense)
+		dense_getSize(&x, &y, node->dense);
+	else
+		getSize(&x, &y, node->world);
+
+	// Rows of the recorded region in this process, which writes nothing
+	// without them
+	first = region->x0 - node->xOffset;
+	last = region->x1 - node->xOffset;
+	if (first < 0) first = 0;
+	if (last > x - 1) last = x - 1;
+	if (last < first) return true;
+
+	buffSize = (last - first + 1)*((region->y1 - region->y0 + 1)*2 + 1) + 2;
 
 	buffer = (char *)mallocC(buffSize * sizeof(char));
 	if (buffer == NULL) return false;
 	pBuffer = buffer;
 
 	// Fill buffer
-	for (i = 0; i < x; ++i) {
-		for (j = 0; j < y; ++j) {
-			struct Cell *cell = getCell(i, j, node->world);
-			if (cell == NULL)
-				pBuffer += sprintf(pBuffer, ". ");
-			else{
-				alive = isCellAlive(cell);
-				pBuffer += sprintf(pBuffer, "%c ", alive? 'o' : '.');
-			}
+	for (i = first; i <= last; ++i) {
+		for (j = region->y0; j <= region->y1; ++j) {
+			alive = isAlive(i, j, node);
+			pBuffer += sprintf(pBuffer, "%c ", alive? 'o' : '.');
 		}
 		pBuffer += sprintf(pBuffer, "\n");
 	}
@@ -246,7 +842,8 @@ bool write(struct MPINode *node)
 	buffer[buffSize-2] = '\0';
 
 	// Write file
-	snprintf(filename, 3+1, "%03Ld", node->itCounter);
+	snprintf(filename, MAX_FILENAME, "%03Ld",
+		node->firstGeneration + node->itCounter);
 	ret = writeBuffer(buffer, buffSize, node->dirName, filename, "w");
 
 	free(buffer);
@@ -254,6 +851,126 @@ bool write(struct MPINode *node)
 	return ret;
 }
 
+/*
+ * Starts from the strip of this process of a snapshot of the size of the
+ * world, whatever the strips it was saved with. It is mapped and unpacked
+ * directly into the engine.
+ */
+bool node_loadSnapshot(const char *fileName, struct MPINode *node)
+{
+	struct Snapshot *snapshot;
+	const struct PackedRows *packed;
+	const unsigned char *bytes;
+	wsize_t x, y;
+	wsize_t i, j;
+
+	if (node->dense)
+		dense_getSize(&x, &y, node->dense);
+	else
+		getSize(&x, &y, node->world);
+
+	snapshot = mapSnapshot(fileName, x, node->xOffset);
+	if (!snapshot) return false;
+
+	if (snapshot->header.x != (uint64_t)node->totalX ||
+	    snapshot->header.y != (uint64_t)y) {
+		unmapSnapshot(snapshot);
+		return false;
+	}
+
+	packed = &snapshot->packed;
+	if (node->dense) {
+		dense_unpackWorld(packed, node->dense);
+	} else {
+		// The sparse engine only needs the alive cells
+		for (i = 0; i < x; ++i) {
+			bytes = &packed->rows[i * packed->rowBytes];
+			for (j = 0; j < y; ++j) {
+				if (!bytes[j/8]) {
+					j |= 7;
+					continue;
+				}
+				if ((bytes[j/8] >> (j%8)) & 1)
+					gol_reviveCell(i, j, node->gol);
+			}
+		}
+	}
+
+	// The snapshot is taken after the generation it is labeled with
+	node->firstGeneration = snapshot->header.generation + 1;
+	unmapSnapshot(snapshot);
+
+	return true;
+}
+
+/*
+ * Saves the world as it is after the last generation. It is collective.
+ */
+bool node_saveSnapshot(const char *fileName, struct MPINode *node)
+{
+	struct PackedRows packed;
+	unsigned long long int generation;
+	wsize_t x, y;
+	bool ret;
+
+	if (node->dense)
+		dense_getSize(&x, &y, node->dense);
+	else
+		getSize(&x, &y, node->world);
+
+	packed.x0 = 0;
+	packed.x1 = x;
+	packed.y0 = 0;
+	packed.y1 = y;
+	packed.rowBytes = (y + 7) / 8;
+	packed.rows = (unsigned char *)mallocC(x * packed.rowBytes);
+	memset(packed.rows, 0, x * packed.rowBytes);
+
+	if (node->dense)
+		dense_packWorld(&packed, node->dense);
+	else
+		packWorld(&packed, node->world);
+
+	// The counter passes the last generation when the run ends
+	generation = node->itCounter < node->params->iterations?
+		node->itCounter : node->params->iterations;
+	ret = saveSnapshot(fileName, node->firstGeneration + generation,
+		&node->params->rule, node->totalX, node->xOffset, &packed);
+
+	free(packed.rows);
+
+	return ret;
+}
+
+static bool writeDensity(struct MPINode *node)
+{
+	clearDensityMap(node->densityMap);
+
+	if (node->dense)
+		dense_addDensity(node->densityMap, node->dense);
+	else
+		addDensity(node->densityMap, node->world);
+
+	return saveDensityMap(node->firstGeneration + node->itCounter,
+		node->densityMap);
+}
+
+static bool writeFrame(struct MPINode *node)
+{
+	clearRecording(node->recording);
+	if (node->recording->packed.x0 == node->recording->packed.x1)
+		return saveFrame(node->firstGeneration + node->itCounter,
+			node->recording);
+
+	if (node->dense)
+		dense_packWorld(&node->recording->packed, node->dense);
+	else
+		packWorld(&node->recording->packed, node->world);
+
+	return saveFrame(node->firstGeneration + node->itCounter,
+		node->recording);
+}
+
 inline int getNumProc(struct MPINode *node)
 {
 	return node->numProc;
@@ -269,7 +986,8 @@ void statsAvg(struct Stats *outStats, struct MPINode *node)
 	int i;
 	double *sendBuff;
 	double *recvBuff, *recvP;
-	size_t sendCount = 6 + node->stats->nThreads;
+	bool tlbCounted = true;
+	size_t sendCount = 9 + 3*node->stats->nThreads;
 	size_t recvCount = sendCount * node->numProc;
 
 	// Allocate buffers
@@ -284,8 +1002,16 @@ void statsAvg(struct Stats *outStats, struct MPINode *node)
 	sendBuff[3] = node->stats->ompIteration;
 	sendBuff[4] = node->stats->cellChecking;
 	sendBuff[5] = node->stats->worldUpdate;
-	for (i = 0; i < node->stats->nThreads; ++i)
-		sendBuff[6 + i] = node->stats->threads[i];
+	sendBuff[6] = node->stats->tlbMisses;
+	sendBuff[7] = node->stats->allocations;
+	sendBuff[8] = node->stats->skippedWords;
+	for (i = 0; i < node->stats->nThreads; ++i) {
+		sendBuff[9 + i] = node->stats->threads[i];
+		sendBuff[9 + node->stats->nThreads + i] =
+			node->stats->steals[i];
+		sendBuff[9 + 2*node->stats->nThreads + i] =
+			node->stats->idle[i];
+	}
 
 	// Receive all stats
 	MPI_Gather(
@@ -301,8 +1027,14 @@ void statsAvg(struct Stats *outStats, struct MPINode *node)
 	outStats->ompIteration  = 0;
 	outStats->cellChecking  = 0;
 	outStats->worldUpdate   = 0;
-	for (i = 0; i < node->stats->nThreads; ++i)
+	outStats->tlbMisses     = 0;
+	outStats->allocations   = 0;
+	outStats->skippedWords  = 0;
+	for (i = 0; i < node->stats->nThreads; ++i) {
 		outStats->threads[i] = 0;
+		outStats->steals[i]  = 0;
+		outStats->idle[i]    = 0;
+	}
 
 	if (node->ownId == 0) {
 		while(recvCount) {
@@ -312,22 +1044,41 @@ void statsAvg(struct Stats *outStats, struct MPINode *node)
 			outStats->ompIteration  += recvP[3];
 			outStats->cellChecking  += recvP[4];
 			outStats->worldUpdate   += recvP[5];
-			for (i = 0; i < node->stats->nThreads; ++i)
-				outStats->threads[i] += recvP[6 + i];
+			// A process without counters makes the total unknown
+			if (recvP[6] < 0.0)
+				tlbCounted = false;
+			else
+				outStats->tlbMisses += recvP[6];
+			outStats->allocations   += recvP[7];
+			outStats->skippedWords  += recvP[8];
+			for (i = 0; i < node->stats->nThreads; ++i) {
+				outStats->threads[i] += recvP[9 + i];
+				outStats->steals[i]  += recvP[9 +
+					node->stats->nThreads + i];
+				outStats->idle[i]    += recvP[9 +
+					2*node->stats->nThreads + i];
+			}
 
 			recvP += sendCount;
 			recvCount -= sendCount;
 		}
 	}
 
-	outStats->total         /= 2.0;
-	outStats->mpiIteration  /= 2.0;
-	outStats->communication /= 2.0;
-	outStats->ompIteration  /= 2.0;
-	outStats->cellChecking  /= 2.0;
-	outStats->worldUpdate   /= 2.0;
-	for (i = 0; i < node->stats->nThreads; ++i)
-		outStats->threads[i] /= 2.0;
+	outStats->total         /= node->numProc;
+	outStats->mpiIteration  /= node->numProc;
+	outStats->communication /= node->numProc;
+	outStats->ompIteration  /= node->numProc;
+	outStats->cellChecking  /= node->numProc;
+	outStats->worldUpdate   /= node->numProc;
+	outStats->tlbMisses      = tlbCounted?
+		outStats->tlbMisses / node->numProc : -1.0;
+	outStats->allocations   /= node->numProc;
+	outStats->skippedWords  /= node->numProc;
+	for (i = 0; i < node->stats->nThreads; ++i) {
+		outStats->threads[i] /= node->numProc;
+		outStats->steals[i]  /= node->numProc;
+		outStats->idle[i]    /= node->numProc;
+	}
 
 	free(sendBuff);
 	free(recvBuff);
@@ -2,14 +2,50 @@
 #define NODE_H_
 
 #include "world.h"
+#include "gol.h"
 #include "stats.h"
+#include "cycle.h"
+#include "affinity.h"
+#include "pages.h"
+#include "halo.h"
+#include "record.h"
+
+enum Engine {
+	ENGINE_SPARSE,
+	ENGINE_DENSE,
+	ENGINE_ENSEMBLE
+};
+
+enum RecordFormat {
+	RECORD_TEXT,
+	RECORD_BINARY
+};
 
 struct Parameters {
 	wsize_t x, y;
 	int numThreads;
 	long long unsigned int iterations;
 	int record;
+	enum RecordFormat recordFormat;
+	struct Region recordRegion;
+	unsigned int recordEvery;
+	int analytics;
+	wsize_t densityRows, densityCols;
+	unsigned int densityEvery;
 	long long unsigned int cells;
+	enum CycleAction cycles;
+	enum Engine engine;
+	struct Rule rule;
+	wsize_t haloDepth;
+	enum Transport transport;
+	bool persistent;
+	long long unsigned int smallCells;
+	unsigned int resort;
+	char *batch;
+	char *loadSnapshot;
+	char *saveSnapshot;
+	enum Affinity affinity;
+	enum HugePages hugePages;
 };
 
 struct MPINode;
@@ -22,7 +58,9 @@ void node_reviveCell(wsize_t x, wsize_t y, struct MPINode *node);
 void node_killCell(wsize_t x, wsize_t y, struct MPINode *node);
 int getNumProc(struct MPINode *node);
 int getNodeId(struct MPINode *node);
-bool write(struct MPINode *node);
+bool node_write(struct MPINode *node);
+bool node_loadSnapshot(const char *fileName, struct MPINode *node);
+bool node_saveSnapshot(const char *fileName, struct MPINode *node);
 
 void statsAvg(struct Stats *outStats, struct MPINode *node);
 
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "pages.h"
+#include "malloc.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define SIZE_2M (1UL << 21)
+#define SIZE_1G (1UL << 30)
+
+// Room before each block to remember how it was reserved
+#define HEADER_SIZE 64
+// Blocks start at different offsets of its pages, otherwise buffers read and
+// written together alias in the cache
+#define COLOR_SIZE (4096 + 64)
+#define COLORS 8
+
+struct LargeHeader {
+	void *base;
+	size_t size;
+	enum HugePages pages;
+};
+
+static enum HugePages hugePagesMode = HUGEPAGES_NONE;
+// Worlds of a batch are created from several threads
+static atomic_uint numBlocks = 0;
+
+static void *mapPages(size_t *size, enum HugePages *pages);
+static void *mapHuge(size_t *size, size_t pageSize, int flags);
+
+inline void setHugePages(enum HugePages hugePages)
+{
+	hugePagesMode = hugePages;
+}
+
+/*
+ * Reserves a big block of memory backed by the selected kind of huge pages.
+ * When they can't be reserved, falls back to the next smaller kind: 1GB, 2MB,
+ * transparent huge pages and finally malloc().
+ */
+void *mallocLarge(size_t size)
+{
+	struct LargeHeader *header;
+	enum HugePages pages = hugePagesMode;
+	size_t offset;
+	char *base;
+
+	offset = HEADER_SIZE + (atomic_fetch_add(&numBlocks, 1) % COLORS) * COLOR_SIZE;
+	size += offset;
+
+	if (pages == HUGEPAGES_NONE)
+		base = (char *)mallocC(size);
+	else
+		base = (char *)mapPages(&size, &pages);
+
+	header = (struct LargeHeader *)(base + offset - HEADER_SIZE);
+	header->base = base;
+	header->size = size;
+	header->pages = pages;
+
+	return base + offset;
+}
+
+void freeLarge(void *ptr)
+{
+	struct LargeHeader *header;
+
+	header = (struct LargeHeader *)((char *)ptr - HEADER_SIZE);
+
+	if (header->pages == HUGEPAGES_NONE)
+		free(header->base);
+	else
+		munmap(header->base, header->size);
+}
+
+static void *mapPages(size_t *size, enum HugePages *pages)
+{
+	void *ptr;
+
+	if (*pages == HUGEPAGES_1G) {
+		ptr = mapHuge(size, SIZE_1G, MAP_HUGETLB | MAP_HUGE_1GB);
+		if (ptr) return ptr;
+		fprintf(stderr, "Can't reserve 1GB pages, trying 2MB pages\n");
+		*pages = HUGEPAGES_2M;
+	}
+
+	if (*pages == HUGEPAGES_2M) {
+		ptr = mapHuge(size, SIZE_2M, MAP_HUGETLB | MAP_HUGE_2MB);
+		if (ptr) return ptr;
+		fprintf(stderr, "Can't reserve 2MB pages, trying transparent "
+			"huge pages\n");
+		*pages = HUGEPAGES_THP;
+	}
+
+	ptr = mapHuge(size, SIZE_2M, 0);
+	if (ptr) {
+		madvise(ptr, *size, MADV_HUGEPAGE);
+		return ptr;
+	}
+
+	*pages = HUGEPAGES_NONE;
+	return mallocC(*size);
+}
+
+static void *mapHuge(size_t *size, size_t pageSize, int flags)
+{
+	void *ptr;
+	size_t mapSize;
+
+	mapSize = (*size + pageSize - 1) & ~(pageSize - 1);
+
+	ptr = mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+	if (ptr == MAP_FAILED) return NULL;
+
+	*size = mapSize;
+	return ptr;
+}
@@ -0,0 +1,17 @@
+#ifndef PAGES_H_
+#define PAGES_H_
+
+#include <stddef.h>
+
+enum HugePages {
+	HUGEPAGES_NONE,
+	HUGEPAGES_THP,
+	HUGEPAGES_2M,
+	HUGEPAGES_1G
+};
+
+void setHugePages(enum HugePages hugePages);
+void *mallocLarge(size_t size);
+void freeLarge(void *ptr);
+
+#endif
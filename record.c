@@ -0,0 +1,128 @@
+#include "record.h"
+#include "malloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Opens the recording of a region of the world, which must be inside it. This
+ * process has the x rows from xOffset on. It is collective, and returns NULL
+ * when the file can't be created.
+ */
+struct Recording *createRecording(const char *fileName, wsize_t x,
+	wsize_t xOffset, const struct Region *region, const struct Rule *rule)
+{
+	struct Recording *recording;
+	struct PackedRows *packed;
+	struct RecordHeader header;
+	wsize_t first, last;
+	int err;
+
+	recording = (struct Recording *)mallocC(sizeof(struct Recording));
+	packed = &recording->packed;
+
+	// Rows of the region in this process, if any
+	first = region->x0 > xOffset? region->x0 : xOffset;
+	last = region->x1 < xOffset + x - 1? region->x1 : xOffset + x - 1;
+	if (last < first) last = first - 1;
+
+	packed->x0 = first - xOffset;
+	packed->x1 = last + 1 - xOffset;
+	packed->y0 = region->y0;
+	packed->y1 = region->y1 + 1;
+	packed->rowBytes = (packed->y1 - packed->y0 + 7) / 8;
+	packed->rows = packed->x1 > packed->x0?
+		(unsigned char *)mallocC((packed->x1 - packed->x0) *
+		packed->rowBytes) : NULL;
+	recording->numFrames = 0;
+	MPI_Comm_rank(MPI_COMM_WORLD, &recording->ownId);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+	header.x = region->x1 - region->x0 + 1;
+	header.y = region->y1 - region->y0 + 1;
+	header.xOrigin = region->x0;
+	header.yOrigin = region->y0;
+	header.rowBytes = packed->rowBytes;
+	header.frameBytes = sizeof(uint64_t) + header.x * packed->rowBytes;
+	header.birth = rule->birth;
+	header.survive = rule->survive;
+
+	recording->frameBytes = header.frameBytes;
+	recording->rowsOffset = sizeof(uint64_t) +
+		(first - region->x0) * packed->rowBytes;
+
+	// Opening doesn't truncate, remove any previous recording
+	if (recording->ownId == 0)
+		MPI_File_delete((char *)fileName, MPI_INFO_NULL);
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	err = MPI_File_open(MPI_COMM_WORLD, (char *)fileName,
+		MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+		&recording->file);
+	if (err != MPI_SUCCESS) goto error;
+
+	if (recording->ownId == 0) {
+		err = MPI_File_write_at(recording->file, 0, &header,
+			sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+		if (err != MPI_SUCCESS) {
+			MPI_File_close(&recording->file);
+			goto error;
+		}
+	}
+
+	return recording;
+
+error:	free(packed->rows);
+	free(recording);
+	return NULL;
+}
+
+void freeRecording(struct Recording *recording)
+{
+	MPI_File_close(&recording->file);
+	free(recording->packed.rows);
+	free(recording);
+}
+
+inline void clearRecording(struct Recording *recording)
+{
+	struct PackedRows *packed = &recording->packed;
+
+	if (packed->rows) {
+		memset(packed->rows, 0, (packed->x1 - packed->x0) *
+			packed->rowBytes);
+	}
+}
+
+/*
+ * Writes the packed rows of this process into the next frame. Each process
+ * writes its own part, without waiting for the rest, and the ones outside the
+ * region write nothing but the generation in the first one.
+ */
+bool saveFrame(unsigned long long int generation,
+	struct Recording *recording)
+{
+	struct PackedRows *packed = &recording->packed;
+	MPI_Offset frame;
+	uint64_t gen = generation;
+	int err;
+
+	frame = sizeof(struct RecordHeader) +
+		recording->numFrames * recording->frameBytes;
+	++recording->numFrames;
+
+	if (recording->ownId == 0) {
+		err = MPI_File_write_at(recording->file, frame, &gen,
+			sizeof(gen), MPI_BYTE, MPI_STATUS_IGNORE);
+		if (err != MPI_SUCCESS) return false;
+	}
+
+	if (packed->x1 == packed->x0) return true;
+
+	err = MPI_File_write_at(recording->file, frame + recording->rowsOffset,
+		packed->rows, (packed->x1 - packed->x0) * packed->rowBytes,
+		MPI_BYTE, MPI_STATUS_IGNORE);
+
+	return err == MPI_SUCCESS;
+}
@@ -0,0 +1,61 @@
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <mpi.h>
+#include "world.h"
+#include "gol.h"
+
+#define RECORD_MAGIC "GOLREC01"
+
+/*
+ * Rectangle of the world, from its first to its last row and column
+ */
+struct Region {
+	wsize_t x0, y0;
+	wsize_t x1, y1;
+};
+
+/*
+ * Binary recording: this header and then one frame per recorded generation,
+ * all of the same size, so frame n starts at sizeof(header) + n*frameBytes.
+ * A frame is the generation as an uint64_t and then the packed rows of the
+ * world. The frames may be a region of the world, whose first cell is at the
+ * origin.
+ */
+struct RecordHeader {
+	char magic[8];
+	uint64_t x;
+	uint64_t y;
+	uint64_t xOrigin;
+	uint64_t yOrigin;
+	uint64_t rowBytes;
+	uint64_t frameBytes;
+	uint32_t birth;
+	uint32_t survive;
+};
+
+/*
+ * Frames being recorded. Each process packs the cells of its part of the
+ * region and writes them at their place in the frame. Processes without rows
+ * in the region have packed.x0 == packed.x1.
+ */
+struct Recording {
+	struct PackedRows packed;
+
+	MPI_File file;
+	MPI_Offset frameBytes;
+	MPI_Offset rowsOffset;
+	unsigned long long int numFrames;
+	int ownId;
+};
+
+struct Recording *createRecording(const char *fileName, wsize_t x,
+	wsize_t xOffset, const struct Region *region, const struct Rule *rule);
+void freeRecording(struct Recording *recording);
+void clearRecording(struct Recording *recording);
+bool saveFrame(unsigned long long int generation,
+	struct Recording *recording);
+
+#endif
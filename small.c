@@ -0,0 +1,339 @@
+#include "small.h"
+#include "malloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+// The words are read as packed rows, the cell j is the bit j%64 of word j/64
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The fast path of small worlds needs a little endian machine"
+#endif
+
+/*
+ * The world is stored twice, a bit per cell, as rows of 64-bit words that are
+ * packed rows too. It wraps around both axes, as the world of a single
+ * process. A generation adds the cells of the 64 neighborhoods of a word at
+ * once with logic operations, and the whole world stays in cache. Nothing is
+ * allocated or timed per generation.
+ */
+struct Small {
+	wsize_t x;
+	wsize_t y;
+	wsize_t words;
+	// Bit of the last column in its word, and bits of the row in that word
+	unsigned int lastBit;
+	uint64_t lastMask;
+
+	uint64_t *cur;
+	uint64_t *next;
+	uint64_t *start;
+	// Each cell added to its left and right neighbors, in two bits, for
+	// four rows
+	uint64_t *sums;
+	uint64_t *carries;
+	struct PackedRows rows;
+	struct PackedRows startRows;
+
+	void (*step)(struct Small *small);
+	struct Rule rule;
+	struct Stats *stats;
+};
+
+static void step(unsigned int birth, unsigned int survive,
+	struct Small *small);
+static void step_generic(struct Small *small);
+static void addSides(wsize_t i, uint64_t *restrict sums,
+	uint64_t *restrict carries, const struct Small *small);
+static uint64_t leftCells(const uint64_t *row, wsize_t w,
+	const struct Small *small);
+static uint64_t rightCells(const uint64_t *row, wsize_t w,
+	const struct Small *small);
+static void add3(uint64_t a, uint64_t b, uint64_t c, uint64_t *sum,
+	uint64_t *carry);
+static uint64_t nextState(uint64_t alive, uint64_t n0, uint64_t n1,
+	uint64_t n2, uint64_t n3, unsigned int birth, unsigned int survive);
+static uint64_t countIs(unsigned int n, uint64_t n0, uint64_t n1,
+	uint64_t n2, uint64_t n3);
+
+/*
+ * Instantiates step for a fixed rule, so its masks are folded into the logic
+ * operations
+ */
+#define DEFINE_STEP(name, birth, survive)				\
+	static void step_##name(struct Small *small)			\
+	{								\
+		step(birth, survive, small);				\
+	}
+
+DEFINE_STEP(B3S23, RULE_3, RULE_2 | RULE_3)
+DEFINE_STEP(B36S23, RULE_3 | RULE_6, RULE_2 | RULE_3)
+DEFINE_STEP(B3678S34678, RULE_3 | RULE_6 | RULE_7 | RULE_8,
+	RULE_3 | RULE_4 | RULE_6 | RULE_7 | RULE_8)
+DEFINE_STEP(B2S, RULE_2, 0)
+
+// Specialized kernels, any other rule uses the generic one
+static const struct Kernel {
+	struct Rule rule;
+	void (*step)(struct Small *small);
+} kernels[] = {
+	{{RULE_3, RULE_2 | RULE_3}, step_B3S23},
+	{{RULE_3 | RULE_6, RULE_2 | RULE_3}, step_B36S23},
+	{{RULE_3 | RULE_6 | RULE_7 | RULE_8,
+	  RULE_3 | RULE_4 | RULE_6 | RULE_7 | RULE_8}, step_B3678S34678},
+	{{RULE_2, 0}, step_B2S}
+};
+
+struct Small *createSmall(wsize_t x, wsize_t y, const struct Rule *rule,
+	struct Stats *stats)
+{
+	struct Small *small;
+	size_t size;
+	unsigned int i;
+
+	small = (struct Small *)mallocC(sizeof(struct Small));
+
+	small->x = x;
+	small->y = y;
+	small->words = (y + 63) / 64;
+	small->lastBit = (y - 1) % 64;
+	small->lastMask = small->lastBit == 63? ~(uint64_t)0 :
+		((uint64_t)1 << (small->lastBit + 1)) - 1;
+	small->rule = *rule;
+	small->stats = stats;
+
+	size = (size_t)x * small->words * sizeof(uint64_t);
+	small->cur = (uint64_t *)mallocC(size);
+	small->next = (uint64_t *)mallocC(size);
+	small->start = (uint64_t *)mallocC(size);
+	small->sums = (uint64_t *)mallocC(4 * small->words * sizeof(uint64_t));
+	small->carries = (uint64_t *)mallocC(
+		4 * small->words * sizeof(uint64_t));
+	memset(small->cur, 0, size);
+	memset(small->next, 0, size);
+	memset(small->start, 0, size);
+
+	small->rows.x0 = 0;
+	small->rows.x1 = x;
+	small->rows.y0 = 0;
+	small->rows.y1 = y;
+	small->rows.rowBytes = small->words * sizeof(uint64_t);
+	small->rows.rows = (unsigned char *)small->cur;
+	small->startRows = small->rows;
+	small->startRows.rows = (unsigned char *)small->start;
+
+	small->step = step_generic;
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+		if (kernels[i].rule.birth == rule->birth &&
+		    kernels[i].rule.survive == rule->survive)
+			small->step = kernels[i].step;
+	}
+
+	return small;
+}
+
+void destroySmall(struct Small *small)
+{
+	free(small->cur);
+	free(small->next);
+	free(small->start);
+	free(small->sums);
+	free(small->carries);
+	free(small);
+}
+
+/*
+ * Rows of the world, packed into before running and unpacked after it
+ */
+inline struct PackedRows *small_getRows(struct Small *small)
+{
+	return &small->rows;
+}
+
+/*
+ * Rows of the world before the last run
+ */
+inline const struct PackedRows *small_getStart(const struct Small *small)
+{
+	return &small->startRows;
+}
+
+/*
+ * Runs the generations in a single thread, timed as a whole
+ */
+void small_run(unsigned long long int generations, struct Small *small)
+{
+	unsigned long long int generation;
+	double ccTime;
+
+	memcpy(small->start, small->cur,
+		(size_t)small->x * small->words * sizeof(uint64_t));
+
+	ccTime = startMeasurement();
+	for (generation = 0; generation < generations; ++generation)
+		small->step(small);
+	endMeasurement(ccTime, cellChecking, small->stats);
+	endMeasurement(ccTime, threads[0], small->stats);
+
+	small->rows.rows = (unsigned char *)small->cur;
+}
+
+/*
+ * Each row is added to its sides once, and those sums of the row above, the
+ * own one and the one below are added into the count of four bits of each
+ * neighborhood, the cell itself included. The sums of the last three rows are
+ * kept, and the ones of the first row until the last one wraps around to it.
+ * It must be inlined into each kernel for the rule to be constant.
+ */
+__attribute__((always_inline))
+inline static void step(unsigned int birth, unsigned int survive,
+	struct Small *small)
+{
+	const wsize_t words = small->words;
+	const uint64_t *mid;
+	uint64_t *upSums, *midSums, *downSums, *firstSums;
+	uint64_t *upCarries, *midCarries, *downCarries, *firstCarries;
+	uint64_t *out, *swap;
+	wsize_t i, w;
+	uint64_t n0, n1, n2, n3, sum, carry, carry2;
+
+	upSums = small->sums;
+	midSums = upSums + words;
+	downSums = midSums + words;
+	firstSums = downSums + words;
+	upCarries = small->carries;
+	midCarries = upCarries + words;
+	downCarries = midCarries + words;
+	firstCarries = downCarries + words;
+
+	addSides(small->x - 1, upSums, upCarries, small);
+	addSides(0, firstSums, firstCarries, small);
+	memcpy(midSums, firstSums, words * sizeof(uint64_t));
+	memcpy(midCarries, firstCarries, words * sizeof(uint64_t));
+
+	for (i = 0; i < small->x; ++i) {
+		if (i < small->x - 1) {
+			addSides(i + 1, downSums, downCarries, small);
+		} else {
+			downSums = firstSums;
+			downCarries = firstCarries;
+		}
+
+		mid = &small->cur[(windex_t)i*words];
+		out = &small->next[(windex_t)i*words];
+		for (w = 0; w < words; ++w) {
+			add3(upSums[w], midSums[w], downSums[w], &n0, &carry);
+			add3(upCarries[w], midCarries[w], downCarries[w], &sum,
+				&carry2);
+			n1 = sum ^ carry;
+			carry &= sum;
+			n2 = carry2 ^ carry;
+			n3 = carry2 & carry;
+
+			out[w] = nextState(mid[w], n0, n1, n2, n3, birth,
+				survive);
+		}
+		out[words - 1] &= small->lastMask;
+
+		// The sums of the row above are not needed anymore, their
+		// storage is reused for the next row
+		swap = upSums;
+		upSums = midSums;
+		midSums = downSums;
+		downSums = swap;
+		swap = upCarries;
+		upCarries = midCarries;
+		midCarries = downCarries;
+		downCarries = swap;
+	}
+
+	swap = small->cur;
+	small->cur = small->next;
+	small->next = swap;
+}
+
+static void step_generic(struct Small *small)
+{
+	step(small->rule.birth, small->rule.survive, small);
+}
+
+/*
+ * Adds each cell of the row i to its left and right neighbors
+ */
+inline static void addSides(wsize_t i, uint64_t *restrict sums,
+	uint64_t *restrict carries, const struct Small *small)
+{
+	const uint64_t *restrict row = &small->cur[(windex_t)i*small->words];
+	const wsize_t last = small->words - 1;
+	wsize_t w;
+
+	// Only the first and last words wrap around, the rest are vectorized
+	add3(leftCells(row, 0, small), row[0], rightCells(row, 0, small),
+		&sums[0], &carries[0]);
+	for (w = 1; w < last; ++w) {
+		add3((row[w] << 1) | (row[w-1] >> 63), row[w],
+			(row[w] >> 1) | (row[w+1] << 63), &sums[w], &carries[w]);
+	}
+	if (last > 0) {
+		add3(leftCells(row, last, small), row[last],
+			rightCells(row, last, small), &sums[last],
+			&carries[last]);
+	}
+}
+
+/*
+ * Left neighbor of each cell of the word w, wrapping around the row
+ */
+inline static uint64_t leftCells(const uint64_t *row, wsize_t w,
+	const struct Small *small)
+{
+	uint64_t carry = w > 0? row[w-1] >> 63 :
+		(row[small->words - 1] >> small->lastBit) & 1;
+
+	return (row[w] << 1) | carry;
+}
+
+inline static uint64_t rightCells(const uint64_t *row, wsize_t w,
+	const struct Small *small)
+{
+	uint64_t carry = w < small->words - 1? row[w+1] << 63 :
+		(row[0] & 1) << small->lastBit;
+
+	return (row[w] >> 1) | carry;
+}
+
+inline static void add3(uint64_t a, uint64_t b, uint64_t c, uint64_t *sum,
+	uint64_t *carry)
+{
+	uint64_t half = a ^ b;
+
+	*sum = half ^ c;
+	*carry = (a & b) | (half & c);
+}
+
+/*
+ * Bit n of each mask is set when the rule applies with n alive neighbors, and
+ * n0 to n3 are the bits of the count of each neighborhood, which includes an
+ * alive cell
+ */
+inline static uint64_t nextState(uint64_t alive, uint64_t n0, uint64_t n1,
+	uint64_t n2, uint64_t n3, unsigned int birth, unsigned int survive)
+{
+	uint64_t born = 0, lives = 0;
+	unsigned int n;
+
+	for (n = 1; n <= 8; ++n) {
+		if ((birth >> (n-1)) & 1)
+			born |= countIs(n, n0, n1, n2, n3);
+		if ((survive >> (n-1)) & 1)
+			lives |= countIs(n + 1, n0, n1, n2, n3);
+	}
+
+	return (alive & lives) | (~alive & born);
+}
+
+inline static uint64_t countIs(unsigned int n, uint64_t n0, uint64_t n1,
+	uint64_t n2, uint64_t n3)
+{
+	return (n & 1? n0 : ~n0) & (n & 2? n1 : ~n1) &
+		(n & 4? n2 : ~n2) & (n & 8? n3 : ~n3);
+}
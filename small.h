@@ -0,0 +1,21 @@
+#ifndef SMALL_H_
+#define SMALL_H_
+
+#include "world.h"
+#include "gol.h"
+#include "stats.h"
+
+// Largest world, in cells, run in the fast path by default
+#define SMALL_CELLS (512*512)
+
+struct Small;
+
+struct Small *createSmall(wsize_t x, wsize_t y, const struct Rule *rule,
+	struct Stats *stats);
+void destroySmall(struct Small *small);
+
+struct PackedRows *small_getRows(struct Small *small);
+const struct PackedRows *small_getStart(const struct Small *small);
+void small_run(unsigned long long int generations, struct Small *small);
+
+#endif
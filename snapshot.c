@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+#include "snapshot.h"
+#include "malloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mpi.h>
+
+// MPI counts are ints, larger strips are written in pieces
+#define MAX_WRITE (1 << 30)
+
+static bool checkHeader(const struct SnapshotHeader *header);
+
+
+bool readSnapshotHeader(const char *fileName, struct SnapshotHeader *header)
+{
+	int fd;
+	ssize_t size;
+
+	fd = open(fileName, O_RDONLY);
+	if (fd == -1) return false;
+
+	size = pread(fd, header, sizeof(struct SnapshotHeader), 0);
+	close(fd);
+
+	return size == sizeof(struct SnapshotHeader) && checkHeader(header);
+}
+
+/*
+ * Maps the x rows from xOffset on, from the page where they start. The pages
+ * are read as they are touched. Returns NULL if the file has not those rows.
+ */
+struct Snapshot *mapSnapshot(const char *fileName, wsize_t x, wsize_t xOffset)
+{
+	struct Snapshot *snapshot;
+	struct stat attrib;
+	off_t start, end, pageStart;
+	int fd;
+
+	snapshot = (struct Snapshot *)mallocC(sizeof(struct Snapshot));
+
+	fd = open(fileName, O_RDONLY);
+	if (fd == -1) goto error;
+
+	if (pread(fd, &snapshot->header, sizeof(struct SnapshotHeader), 0) !=
+	    sizeof(struct SnapshotHeader) ||
+	    !checkHeader(&snapshot->header) ||
+	    (uint64_t)(xOffset + x) > snapshot->header.x ||
+	    fstat(fd, &attrib) == -1)
+		goto errorFile;
+
+	start = SNAPSHOT_DATA + xOffset * snapshot->header.rowBytes;
+	end = start + x * snapshot->header.rowBytes;
+	if (attrib.st_size < end) goto errorFile;
+
+	pageStart = start & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+	snapshot->mapSize = end - pageStart;
+	snapshot->map = mmap(NULL, snapshot->mapSize, PROT_READ, MAP_PRIVATE,
+		fd, pageStart);
+	if (snapshot->map == MAP_FAILED) goto errorFile;
+	close(fd);
+
+	// The rows are unpacked once, in order
+	madvise(snapshot->map, snapshot->mapSize, MADV_SEQUENTIAL);
+
+	snapshot->packed.x0 = 0;
+	snapshot->packed.x1 = x;
+	snapshot->packed.y0 = 0;
+	snapshot->packed.y1 = snapshot->header.y;
+	snapshot->packed.rowBytes = snapshot->header.rowBytes;
+	snapshot->packed.rows = (unsigned char *)snapshot->map +
+		(start - pageStart);
+
+	return snapshot;
+
+errorFile:
+	close(fd);
+error:	free(snapshot);
+	return NULL;
+}
+
+void unmapSnapshot(struct Snapshot *snapshot)
+{
+	munmap(snapshot->map, snapshot->mapSize);
+	free(snapshot);
+}
+
+/*
+ * Writes the rows of every process at their place of the file, with the
+ * header written by the first one. It is collective.
+ */
+bool saveSnapshot(const char *fileName, unsigned long long int generation,
+	const struct Rule *rule, wsize_t totalX, wsize_t xOffset,
+	const struct PackedRows *packed)
+{
+	struct SnapshotHeader header;
+	MPI_File file;
+	MPI_Offset offset;
+	size_t size, count;
+	const unsigned char *rows;
+	int ownId;
+	int err;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &ownId);
+
+	// Opening doesn't truncate, remove any previous snapshot
+	if (ownId == 0) MPI_File_delete((char *)fileName, MPI_INFO_NULL);
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	err = MPI_File_open(MPI_COMM_WORLD, (char *)fileName,
+		MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+	if (err != MPI_SUCCESS) return false;
+
+	if (ownId == 0) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+		header.x = totalX;
+		header.y = packed->y1 - packed->y0;
+		header.rowBytes = packed->rowBytes;
+		header.generation = generation;
+		header.birth = rule->birth;
+		header.survive = rule->survive;
+
+		err = MPI_File_write_at(file, 0, &header, sizeof(header),
+			MPI_BYTE, MPI_STATUS_IGNORE);
+	}
+
+	offset = SNAPSHOT_DATA + xOffset * packed->rowBytes;
+	size = (packed->x1 - packed->x0) * packed->rowBytes;
+	rows = packed->rows;
+	while (err == MPI_SUCCESS && size) {
+		count = size < MAX_WRITE? size : MAX_WRITE;
+		err = MPI_File_write_at(file, offset, (void *)rows, count,
+			MPI_BYTE, MPI_STATUS_IGNORE);
+		offset += count;
+		rows += count;
+		size -= count;
+	}
+
+	MPI_File_close(&file);
+
+	return err == MPI_SUCCESS;
+}
+
+static bool checkHeader(const struct SnapshotHeader *header)
+{
+	return memcmp(header->magic, SNAPSHOT_MAGIC,
+		sizeof(header->magic)) == 0 &&
+		header->x > 0 && header->y > 0 &&
+		header->rowBytes == (header->y + 7) / 8;
+}
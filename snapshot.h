@@ -0,0 +1,46 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "world.h"
+#include "gol.h"
+
+#define SNAPSHOT_MAGIC "GOLSNP02"
+// The rows start at a page boundary, after the header
+#define SNAPSHOT_DATA 4096
+
+/*
+ * World saved as its packed rows, so each process maps the rows of its strip
+ * without reading the rest. Nothing of the decomposition it was saved with is
+ * kept, any number of processes can load it.
+ */
+struct SnapshotHeader {
+	char magic[8];
+	uint64_t x;
+	uint64_t y;
+	uint64_t rowBytes;
+	uint64_t generation;
+	uint32_t birth;
+	uint32_t survive;
+};
+
+/*
+ * Strip of a snapshot mapped in memory, 'packed' points into the mapping
+ */
+struct Snapshot {
+	struct SnapshotHeader header;
+	struct PackedRows packed;
+	void *map;
+	size_t mapSize;
+};
+
+bool readSnapshotHeader(const char *fileName, struct SnapshotHeader *header);
+struct Snapshot *mapSnapshot(const char *fileName, wsize_t x, wsize_t xOffset);
+void unmapSnapshot(struct Snapshot *snapshot);
+bool saveSnapshot(const char *fileName, unsigned long long int generation,
+	const struct Rule *rule, wsize_t totalX, wsize_t xOffset,
+	const struct PackedRows *packed);
+
+#endif
@@ -1,7 +1,12 @@
+#define _GNU_SOURCE
 #include "stats.h"
 #include "io.h"
 #include "malloc.h"
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include <omp.h>
 
 #define _TO_STR(val) #val
@@ -21,6 +26,9 @@ struct Stats *createStats(unsigned long long int iterations, int nThreads)
 
 	stats = (struct Stats *)mallocC(sizeof(struct Stats));
 	stats->threads = (double *)mallocC(nThreads * sizeof(double));
+	stats->steals = (double *)mallocC(nThreads * sizeof(double));
+	stats->idle = (double *)mallocC(nThreads * sizeof(double));
+	stats->tlbCounters = (int *)mallocC(nThreads * sizeof(int));
 
 	stats->avgFactor = 1.0/(double)iterations;
 	stats->nThreads = nThreads;
@@ -31,9 +39,17 @@ struct Stats *createStats(unsigned long long int iterations, int nThreads)
 	stats->ompIteration = 0.0;
 	stats->cellChecking = 0.0;
 	stats->worldUpdate = 0.0;
+	stats->allocations = 0.0;
+	// Only the dense engine skips words, it starts them at 0
+	stats->skippedWords = -1.0;
+	stats->tlbMisses = -1.0;
 
-	for (i = 0; i < nThreads; ++i)
+	for (i = 0; i < nThreads; ++i) {
 		stats->threads[i] = 0.0;
+		stats->steals[i] = 0.0;
+		stats->idle[i] = 0.0;
+		stats->tlbCounters[i] = -1;
+	}
 
 	return stats;
 }
@@ -41,9 +57,60 @@ struct Stats *createStats(unsigned long long int iterations, int nThreads)
 void freeStats(struct Stats *stats)
 {
 	free(stats->threads);
+	free(stats->steals);
+	free(stats->idle);
+	free(stats->tlbCounters);
 	free(stats);
 }
 
+/*
+ * Opens a counter of data TLB misses for each thread. They are not available
+ * in every machine or with a restrictive perf_event_paranoid.
+ */
+void startCounters(struct Stats *stats)
+{
+	#pragma omp parallel
+	{
+		struct perf_event_attr attr;
+		int threadNum = omp_get_thread_num();
+
+		memset(&attr, 0, sizeof(struct perf_event_attr));
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.size = sizeof(struct perf_event_attr);
+		attr.config = PERF_COUNT_HW_CACHE_DTLB |
+			(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		if (threadNum < stats->nThreads) {
+			stats->tlbCounters[threadNum] =
+				syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+	}
+}
+
+void endCounters(struct Stats *stats)
+{
+	int i;
+	long long int count;
+
+	stats->tlbMisses = 0.0;
+
+	for (i = 0; i < stats->nThreads; ++i) {
+		if (stats->tlbCounters[i] < 0 ||
+		    read(stats->tlbCounters[i], &count, sizeof(count)) !=
+			sizeof(count))
+		{
+			stats->tlbMisses = -1.0;
+		} else if (stats->tlbMisses >= 0.0)
+			stats->tlbMisses += count;
+
+		if (stats->tlbCounters[i] >= 0) close(stats->tlbCounters[i]);
+		stats->tlbCounters[i] = -1;
+	}
+}
+
 bool saveStats(struct Stats *stats)
 {
 	int i;
@@ -52,7 +119,7 @@ bool saveStats(struct Stats *stats)
 	int written;
 
 	maxLineSize = STRLEN("            Thread9      \n") + DIGS;
-	maxBuffSize = (6 + stats->nThreads)*maxLineSize + 1;
+	maxBuffSize = (9 + 3*stats->nThreads)*maxLineSize + 1;
 	buffer = (char *)mallocC(maxBuffSize * sizeof(char));
 	pBuffer = buffer;
 
@@ -74,13 +141,47 @@ bool saveStats(struct Stats *stats)
 
 	for (i = 0; i < stats->nThreads; ++i) {
 		written += snprintf(pBuffer, maxBuffSize - written,
-			"            Thread%d      " PF_FORM "\n",
+			"            Thread%d      " PF_FORM "\n"
+			"               Steals    " PF_FORM "\n"
+			"               Idle      " PF_FORM "\n",
 			i,
-			stats->threads[i]
+			stats->threads[i],
+			stats->steals[i],
+			stats->idle[i]
 		);
 		pBuffer = buffer + written;
 	}
 
+	if (stats->tlbMisses >= 0.0) {
+		written += snprintf(pBuffer, maxBuffSize - written,
+			"DTLB misses              " PF_FORM "\n",
+			stats->tlbMisses
+		);
+	} else {
+		written += snprintf(pBuffer, maxBuffSize - written,
+			"DTLB misses              n/a\n"
+		);
+	}
+	pBuffer = buffer + written;
+
+	written += snprintf(pBuffer, maxBuffSize - written,
+		"Allocations              " PF_FORM "\n",
+		stats->allocations
+	);
+	pBuffer = buffer + written;
+
+	if (stats->skippedWords >= 0.0) {
+		written += snprintf(pBuffer, maxBuffSize - written,
+			"Skipped words            " PF_FORM "\n",
+			stats->skippedWords
+		);
+	} else {
+		written += snprintf(pBuffer, maxBuffSize - written,
+			"Skipped words            n/a\n"
+		);
+	}
+	pBuffer = buffer + written;
+
 	writeBuffer(buffer, written, "./", "stats", "w");
 	free(buffer);
 
@@ -97,8 +198,14 @@ bool saveStatsGnuplot(
 	char *buffer, *pBuffer;
 	size_t maxBuffSize;
 	int written = 0;
+	double steals = 0.0, idle = 0.0;
 
-	maxBuffSize = 3*20 + (6 + stats->nThreads + 1)*DIGS + 1;
+	for (i = 0; i < stats->nThreads; ++i) {
+		steals += stats->steals[i];
+		idle += stats->idle[i] / stats->nThreads;
+	}
+
+	maxBuffSize = 3*20 + (11 + stats->nThreads + 1)*DIGS + 1;
 	buffer = (char *)mallocC(maxBuffSize * sizeof(char));
 	pBuffer = buffer;
 
@@ -111,6 +218,11 @@ bool saveStatsGnuplot(
 		PF_FORM "\t"
 		PF_FORM "\t"
 		PF_FORM "\t"
+		PF_FORM "\t"
+		PF_FORM "\t"
+		PF_FORM "\t"
+		PF_FORM "\t"
+		PF_FORM "\t"
 		PF_FORM "\t",
 
 		iterations,
@@ -121,7 +233,12 @@ bool saveStatsGnuplot(
 		stats->communication,
 		stats->ompIteration,
 		stats->cellChecking,
-		stats->worldUpdate
+		stats->worldUpdate,
+		stats->tlbMisses,
+		stats->allocations,
+		stats->skippedWords,
+		steals,
+		idle
 	);
 	pBuffer = buffer + written;
 
@@ -14,11 +14,25 @@ struct Stats {
 	double cellChecking;
 	double worldUpdate;
 	double *threads;
+	// Chunks stolen by each thread and time it waited for the rest
+	double *steals;
+	double *idle;
+
+	// Memory reserved per generation
+	double allocations;
+	// Fraction of the words of the dense world skipped per generation
+	double skippedWords;
+
+	// Negative when the counters are not available
+	double tlbMisses;
+	int *tlbCounters;
 };
 
 
 struct Stats *createStats(unsigned long long int iterations, int nThreads);
 void freeStats(struct Stats *stats);
+void startCounters(struct Stats *stats);
+void endCounters(struct Stats *stats);
 
 #define startMeasurement() omp_get_wtime()
 
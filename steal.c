@@ -0,0 +1,201 @@
+#include "steal.h"
+#include "malloc.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <omp.h>
+
+// Cache line size, so the deques of the threads don't share lines
+#define LINE_SIZE 64
+
+#define RANGE(first, last) \
+	(((unsigned long long int)(first) << 32) | (unsigned long long int)(last))
+#define RANGE_FIRST(range) ((unsigned int)((range) >> 32))
+#define RANGE_LAST(range) ((unsigned int)(range))
+
+/*
+ * Each thread starts with an equal part of the range in its deque, and takes
+ * chunks from its front. A thread with an empty deque steals the back half of
+ * the work left in another one. The pending range of a deque is a single word,
+ * updated with compare and swap by its owner and the thieves.
+ */
+struct Deque {
+	atomic_ullong range;
+	unsigned long long int steals;
+	double finish;
+	char pad[LINE_SIZE - sizeof(atomic_ullong) -
+		sizeof(unsigned long long int) - sizeof(double)];
+};
+
+struct Steal {
+	struct Deque *deques;
+	unsigned int numThreads;
+	unsigned int chunk;
+};
+
+static bool takeChunk(struct Deque *deque, unsigned int chunk,
+	unsigned int *first, unsigned int *last);
+static bool stealHalf(struct Deque *victim, unsigned int chunk,
+	unsigned int *first, unsigned int *last);
+
+
+struct Steal *createSteal(unsigned int numThreads)
+{
+	struct Steal *steal;
+	unsigned int i;
+
+	steal = (struct Steal *)mallocC(sizeof(struct Steal));
+	steal->deques = (struct Deque *)aligned_alloc(LINE_SIZE,
+		numThreads * sizeof(struct Deque));
+	if (steal->deques == NULL) {
+		fprintf(stderr, "Can't reserve memory\n");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	steal->numThreads = numThreads;
+	steal->chunk = 1;
+
+	for (i = 0; i < numThreads; ++i) {
+		atomic_init(&steal->deques[i].range, RANGE(0, 0));
+		steal->deques[i].steals = 0;
+		steal->deques[i].finish = -1.0;
+	}
+
+	return steal;
+}
+
+void freeSteal(struct Steal *steal)
+{
+	free(steal->deques);
+	free(steal);
+}
+
+/*
+ * Splits the indices from first to last, excluded, between the deques. Must be
+ * called before the threads take any of them.
+ */
+void steal_reset(unsigned int first, unsigned int last, unsigned int chunk,
+	struct Steal *steal)
+{
+	unsigned int i;
+	unsigned int size = last > first? last - first : 0;
+	unsigned int start, end;
+
+	steal->chunk = chunk > 0? chunk : 1;
+
+	for (i = 0; i < steal->numThreads; ++i) {
+		start = first + (unsigned long long int)size * i /
+			steal->numThreads;
+		end = first + (unsigned long long int)size * (i + 1) /
+			steal->numThreads;
+		atomic_store_explicit(&steal->deques[i].range,
+			RANGE(start, end), memory_order_relaxed);
+		steal->deques[i].finish = -1.0;
+	}
+}
+
+/*
+ * Next chunk of indices for the calling thread, from its own deque or stolen
+ * from another one. Returns false once there is no work left.
+ */
+bool steal_next(unsigned int *first, unsigned int *last, struct Steal *steal)
+{
+	unsigned int threadNum = omp_get_thread_num();
+	unsigned int i, victim;
+	unsigned int stolen;
+	struct Deque *own;
+
+	// Threads beyond the deques only steal
+	own = threadNum < steal->numThreads? &steal->deques[threadNum] : NULL;
+
+	if (own && takeChunk(own, steal->chunk, first, last))
+		return true;
+
+	for (i = 1; i <= steal->numThreads; ++i) {
+		victim = (threadNum + i) % steal->numThreads;
+		if (&steal->deques[victim] == own) continue;
+
+		if (!stealHalf(&steal->deques[victim], steal->chunk, first,
+		    &stolen))
+			continue;
+
+		// The rest of the stolen half goes to the own deque, where it
+		// can be stolen again
+		*last = stolen - *first > steal->chunk?
+			*first + steal->chunk : stolen;
+		if (own) {
+			atomic_store_explicit(&own->range,
+				RANGE(*last, stolen), memory_order_release);
+			++(own->steals);
+		} else {
+			*last = stolen;
+		}
+		return true;
+	}
+
+	if (own) own->finish = omp_get_wtime();
+	return false;
+}
+
+/*
+ * Adds the steals of each thread and the time it waited for the rest since it
+ * ran out of work. Called after the threads are done.
+ */
+void steal_addStats(struct Stats *stats, struct Steal *steal)
+{
+	double end = omp_get_wtime();
+	unsigned int i;
+
+	for (i = 0; i < steal->numThreads && i < (unsigned int)stats->nThreads;
+	     ++i) {
+		stats->steals[i] += stats->avgFactor * steal->deques[i].steals;
+		if (steal->deques[i].finish >= 0.0) {
+			stats->idle[i] += stats->avgFactor *
+				(end - steal->deques[i].finish);
+		}
+		steal->deques[i].steals = 0;
+	}
+}
+
+static bool takeChunk(struct Deque *deque, unsigned int chunk,
+	unsigned int *first, unsigned int *last)
+{
+	unsigned long long int range;
+	unsigned int f, l;
+
+	range = atomic_load_explicit(&deque->range, memory_order_acquire);
+	do {
+		f = RANGE_FIRST(range);
+		l = RANGE_LAST(range);
+		if (f >= l) return false;
+
+		*first = f;
+		*last = l - f > chunk? f + chunk : l;
+	} while (!atomic_compare_exchange_weak(&deque->range, &range,
+		RANGE(*last, l)));
+
+	return true;
+}
+
+/*
+ * Takes the back half of the work of the victim, all of it when it is a
+ * single chunk. 'first' and 'last' delimit the stolen range.
+ */
+static bool stealHalf(struct Deque *victim, unsigned int chunk,
+	unsigned int *first, unsigned int *last)
+{
+	unsigned long long int range;
+	unsigned int f, l, mid;
+
+	range = atomic_load_explicit(&victim->range, memory_order_acquire);
+	do {
+		f = RANGE_FIRST(range);
+		l = RANGE_LAST(range);
+		if (f >= l) return false;
+
+		mid = l - f > chunk? f + (l - f) / 2 : f;
+		*first = mid;
+		*last = l;
+	} while (!atomic_compare_exchange_weak(&victim->range, &range,
+		RANGE(f, mid)));
+
+	return true;
+}
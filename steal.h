@@ -0,0 +1,17 @@
+#ifndef STEAL_H_
+#define STEAL_H_
+
+#include <stdbool.h>
+#include "stats.h"
+
+struct Steal;
+
+struct Steal *createSteal(unsigned int numThreads);
+void freeSteal(struct Steal *steal);
+
+void steal_reset(unsigned int first, unsigned int last, unsigned int chunk,
+	struct Steal *steal);
+bool steal_next(unsigned int *first, unsigned int *last, struct Steal *steal);
+void steal_addStats(struct Stats *stats, struct Steal *steal);
+
+#endif
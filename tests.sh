@@ -1,16 +1,16 @@
 #!/bin/bash
 
 HEADER="ITERATIONS\tSIZE\tCELLS\tTOTAL\tMPI_IT\tCOMM\tOMP_IT\tCELL_CHK\tWORLD_UP\
-\tTHREAD_0\tTHREAD_1\tTHREAD_2\tTHREAD_3\tTHREAD_4\tTHREAD_5\tTHREAD_6\tTHREAD_7\tTHREAD_8"
+\tDTLB_MISS\tALLOCS\tSKIPPED\tSTEALS\tIDLE\tTHREAD_0\tTHREAD_1\tTHREAD_2\tTHREAD_3\tTHREAD_4\tTHREAD_5\tTHREAD_6\tTHREAD_7\tTHREAD_8"
 
 ITERATIONS=5000
 CELLS=5000
 SIZE=1000
 EXECUTABLE="build/gameOfLife"
 
-# run proccess threads size cells iterations
+# run proccess threads size cells iterations [extra options]
 function run() {
-	mpirun -n $1 $EXECUTABLE -t$2 -s$3 -c$4 -i$5
+	mpirun -n $1 $EXECUTABLE -t$2 -s$3 -c$4 -i$5 "${@:6}"
 }
 
 function sizeRun() {
@@ -135,3 +135,35 @@ addHeader stats.data gnuplot/n1t2.data
 > stats.data
 run 2 1 ${SIZE}x${SIZE} $CELLS $ITERATIONS
 addHeader stats.data gnuplot/n2t1.data
+
+for pages in none thp 2m 1g; do
+	> stats.data
+	run 1 1 ${SIZE}x${SIZE} $CELLS $ITERATIONS --engine dense --hugepages $pages
+	addHeader stats.data gnuplot/hugepages_${pages}.data
+done
+
+for halo in 1 2 4 8 16 32; do
+	> stats.data
+	run 4 1 ${SIZE}x${SIZE} $CELLS $ITERATIONS --engine dense --halo-depth $halo
+	addHeader stats.data gnuplot/halo_${halo}.data
+done
+
+for transport in msg shm rma; do
+	> stats.data
+	run 4 1 ${SIZE}x${SIZE} $CELLS $ITERATIONS --transport $transport
+	addHeader stats.data gnuplot/transport_${transport}.data
+done
+
+for resort in 0 1 5 20; do
+	> stats.data
+	run 1 1 ${SIZE}x${SIZE} $CELLS $ITERATIONS --resort $resort
+	addHeader stats.data gnuplot/resort_${resort}.data
+done
+
+for engine in sparse dense; do
+	for rule in B3/S23 B36/S23 B3678/S34678 B2/S B1357/S1357; do
+		> stats.data
+		run 1 1 ${SIZE}x${SIZE} $CELLS $ITERATIONS --engine $engine --rule $rule
+		addHeader stats.data gnuplot/rules_${engine}_${rule//\//}.data
+	done
+done
@@ -0,0 +1,475 @@
+#define _GNU_SOURCE
+#include "record.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Characters by fraction of alive cells of the block they show
+#define SHADES " .:oO@"
+#define NUM_SHADES (sizeof(SHADES) - 1)
+// Rows of a block that are counted, the rest are skipped when zoomed out
+#define MAX_SAMPLES 16
+// Milliseconds between frames, the shortest about the rate of a display
+#define MIN_PERIOD 16
+#define MAX_PERIOD 2048
+#define MAX_PROMPT 32
+
+/*
+ * Replay of a memory mapped recording. The frames have all the same size, so
+ * any of them is found without reading the others.
+ */
+struct Replay {
+	const unsigned char *data;
+	size_t size;
+	struct RecordHeader header;
+	unsigned long long int numFrames;
+	unsigned long long int frame;
+
+	// Cells of each side of a character and first cell on the screen
+	long long int zoom;
+	long long int top;
+	long long int left;
+	int rows;
+	int cols;
+
+	char *screen;
+	size_t screenSize;
+	unsigned int period;
+	bool paused;
+};
+
+static struct termios oldTerm;
+
+static bool openReplay(const char *fileName, struct Replay *replay);
+static void closeReplay(struct Replay *replay);
+static uint64_t frameGeneration(unsigned long long int frame,
+	const struct Replay *replay);
+static unsigned long long int findGeneration(uint64_t generation,
+	const struct Replay *replay);
+static unsigned int countBlock(const unsigned char *rows, long long int x0,
+	long long int x1, long long int y0, long long int y1,
+	const struct Replay *replay);
+static void render(const char *prompt, struct Replay *replay);
+static void startTerminal(void);
+static void endTerminal(void);
+static int readKey(int timeout);
+static bool readGeneration(uint64_t *generation, struct Replay *replay);
+static void setZoom(long long int zoom, struct Replay *replay);
+static void pan(int dx, int dy, struct Replay *replay);
+
+int main(int argc, char *argv[])
+{
+	struct Replay replay;
+	uint64_t generation;
+	int key;
+	bool quit = false;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <recording>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (!openReplay(argv[1], &replay)) {
+		fprintf(stderr, "Can't read the recording '%s'\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	startTerminal();
+
+	while (!quit) {
+		render(NULL, &replay);
+
+		key = readKey(replay.paused? -1 : (int)replay.period);
+		switch (key) {
+			case -1:
+			case 'f':
+				replay.frame = (replay.frame + 1) %
+					replay.numFrames;
+				break;
+			case 'b':
+				replay.frame = (replay.frame +
+					replay.numFrames - 1) % replay.numFrames;
+				break;
+			case 'r':
+				replay.frame = 0;
+				break;
+			case 'p':
+			case ' ':
+				replay.paused = !replay.paused;
+				break;
+			case '+':
+				if (replay.period > MIN_PERIOD)
+					replay.period /= 2;
+				break;
+			case '-':
+				if (replay.period < MAX_PERIOD)
+					replay.period *= 2;
+				break;
+			case 'g':
+				if (readGeneration(&generation, &replay))
+					replay.frame = findGeneration(generation,
+						&replay);
+				break;
+			case 'z':
+				setZoom(replay.zoom / 2, &replay);
+				break;
+			case 'x':
+				setZoom(replay.zoom * 2, &replay);
+				break;
+			case 'k':
+			case 'A':
+				pan(-1, 0, &replay);
+				break;
+			case 'j':
+			case 'B':
+				pan(1, 0, &replay);
+				break;
+			case 'l':
+			case 'C':
+				pan(0, 1, &replay);
+				break;
+			case 'h':
+			case 'D':
+				pan(0, -1, &replay);
+				break;
+			case 'q':
+				quit = true;
+				break;
+		}
+	}
+
+	endTerminal();
+	closeReplay(&replay);
+
+	return EXIT_SUCCESS;
+}
+
+static bool openReplay(const char *fileName, struct Replay *replay)
+{
+	struct stat attrib;
+	int fd;
+
+	fd = open(fileName, O_RDONLY);
+	if (fd == -1) return false;
+
+	if (fstat(fd, &attrib) == -1 ||
+	    (size_t)attrib.st_size < sizeof(struct RecordHeader)) {
+		close(fd);
+		return false;
+	}
+
+	replay->size = attrib.st_size;
+	replay->data = (const unsigned char *)mmap(NULL, replay->size,
+		PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (replay->data == MAP_FAILED) return false;
+
+	memcpy(&replay->header, replay->data, sizeof(struct RecordHeader));
+	if (memcmp(replay->header.magic, RECORD_MAGIC,
+	    sizeof(replay->header.magic)) != 0 ||
+	    replay->header.frameBytes == 0 ||
+	    replay->header.frameBytes < sizeof(uint64_t) +
+	    replay->header.x * replay->header.rowBytes) {
+		munmap((void *)replay->data, replay->size);
+		return false;
+	}
+
+	// Frames still being written are left out
+	replay->numFrames = (replay->size - sizeof(struct RecordHeader)) /
+		replay->header.frameBytes;
+	if (replay->numFrames == 0) {
+		munmap((void *)replay->data, replay->size);
+		return false;
+	}
+
+	// Frames are read as they are shown, possibly in any order
+	madvise((void *)replay->data, replay->size, MADV_RANDOM);
+
+	replay->frame = 0;
+	replay->zoom = 1;
+	replay->top = 0;
+	replay->left = 0;
+	replay->rows = 0;
+	replay->cols = 0;
+	replay->screen = NULL;
+	replay->screenSize = 0;
+	replay->period = 128;
+	replay->paused = false;
+
+	return true;
+}
+
+static void closeReplay(struct Replay *replay)
+{
+	munmap((void *)replay->data, replay->size);
+	free(replay->screen);
+}
+
+static uint64_t frameGeneration(unsigned long long int frame,
+	const struct Replay *replay)
+{
+	uint64_t generation;
+
+	memcpy(&generation, replay->data + sizeof(struct RecordHeader) +
+		frame * replay->header.frameBytes, sizeof(generation));
+
+	return generation;
+}
+
+/*
+ * Last frame not after the generation. The generations grow with the frames,
+ * but not always by the same step, so they are bisected.
+ */
+static unsigned long long int findGeneration(uint64_t generation,
+	const struct Replay *replay)
+{
+	unsigned long long int low = 0, high = replay->numFrames, mid;
+
+	while (high - low > 1) {
+		mid = low + (high - low) / 2;
+		if (frameGeneration(mid, replay) <= generation)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/*
+ * Alive cells of the block, counting up to MAX_SAMPLES evenly spaced rows.
+ * Whole words of the rows are counted at once.
+ */
+static unsigned int countBlock(const unsigned char *rows, long long int x0,
+	long long int x1, long long int y0, long long int y1,
+	const struct Replay *replay)
+{
+	const unsigned char *row;
+	long long int i, j, step;
+	unsigned int count = 0;
+	uint64_t word;
+
+	step = (x1 - x0 + MAX_SAMPLES - 1) / MAX_SAMPLES;
+
+	for (i = x0; i < x1; i += step) {
+		row = rows + i * replay->header.rowBytes;
+
+		for (j = y0; j < y1 && j % 8; ++j)
+			count += (row[j/8] >> (j%8)) & 1;
+		for (; j + 64 <= y1; j += 64) {
+			memcpy(&word, &row[j/8], sizeof(word));
+			count += __builtin_popcountll(word);
+		}
+		for (; j < y1; ++j)
+			count += (row[j/8] >> (j%8)) & 1;
+	}
+
+	return count;
+}
+
+/*
+ * Draws the visible part of the frame and a status line, all with a single
+ * write so the terminal doesn't flicker
+ */
+static void render(const char *prompt, struct Replay *replay)
+{
+	struct winsize ws;
+	const unsigned char *rows;
+	long long int x0, x1, y0, y1, sampled;
+	unsigned int count;
+	size_t needed;
+	char *p;
+	int i, j, n;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_row < 2) {
+		ws.ws_row = 24;
+		ws.ws_col = 80;
+	}
+	replay->rows = ws.ws_row - 1;
+	replay->cols = ws.ws_col;
+
+	needed = (size_t)(replay->rows + 1) * (replay->cols + 8) + 256;
+	if (needed > replay->screenSize) {
+		replay->screen = (char *)realloc(replay->screen, needed);
+		if (!replay->screen) {
+			endTerminal();
+			fprintf(stderr, "Can't reserve memory\n");
+			exit(EXIT_FAILURE);
+		}
+		replay->screenSize = needed;
+	}
+
+	rows = replay->data + sizeof(struct RecordHeader) +
+		replay->frame * replay->header.frameBytes + sizeof(uint64_t);
+
+	p = replay->screen;
+	p += sprintf(p, "\033[H");
+	for (i = 0; i < replay->rows; ++i) {
+		x0 = replay->top + i * replay->zoom;
+		x1 = x0 + replay->zoom;
+		if (x1 > (long long int)replay->header.x)
+			x1 = replay->header.x;
+
+		for (j = 0; j < replay->cols && x0 < x1; ++j) {
+			y0 = replay->left + j * replay->zoom;
+			y1 = y0 + replay->zoom;
+			if (y1 > (long long int)replay->header.y)
+				y1 = replay->header.y;
+			if (y0 >= y1) break;
+
+			count = countBlock(rows, x0, x1, y0, y1, replay);
+			sampled = ((x1 - x0 + MAX_SAMPLES - 1) / MAX_SAMPLES);
+			sampled = ((x1 - x0 + sampled - 1) / sampled) * (y1 - y0);
+
+			// Any alive cell is shown, however few
+			*p++ = SHADES[count? 1 + count * (NUM_SHADES - 2) /
+				sampled : 0];
+		}
+		p += sprintf(p, "\033[K\r\n");
+	}
+
+	if (prompt) {
+		p += sprintf(p, "%s\033[K", prompt);
+	} else {
+		n = snprintf(p, replay->cols + 1,
+			"Gen %llu  frame %llu/%llu  zoom %lld  cell (%lld,%lld)  "
+			"period %u ms %s",
+			(unsigned long long int)frameGeneration(replay->frame,
+				replay),
+			replay->frame + 1, replay->numFrames, replay->zoom,
+			replay->top + (long long int)replay->header.xOrigin,
+			replay->left + (long long int)replay->header.yOrigin,
+			replay->period,
+			replay->paused? "[PAUSE]" : "");
+		p += n < replay->cols? n : replay->cols;
+		p += sprintf(p, "\033[K");
+	}
+
+	if (write(STDOUT_FILENO, replay->screen, p - replay->screen) < 0)
+		return;
+}
+
+static void startTerminal(void)
+{
+	struct termios term;
+
+	tcgetattr(STDIN_FILENO, &oldTerm);
+	term = oldTerm;
+	term.c_lflag &= ~(ICANON | ECHO);
+	term.c_cc[VMIN] = 1;
+	term.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSANOW, &term);
+
+	// Alternate screen without cursor
+	printf("\033[?1049h\033[?25l\033[2J");
+	fflush(stdout);
+}
+
+static void endTerminal(void)
+{
+	printf("\033[?25h\033[?1049l");
+	fflush(stdout);
+	tcsetattr(STDIN_FILENO, TCSANOW, &oldTerm);
+}
+
+/*
+ * Next key, or -1 if none is pressed in 'timeout' milliseconds. The arrows
+ * are returned as the last character of their sequence.
+ */
+static int readKey(int timeout)
+{
+	struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	unsigned char seq[2];
+	unsigned char key;
+
+	if (poll(&pfd, 1, timeout) <= 0) return -1;
+	if (read(STDIN_FILENO, &key, 1) != 1) return 'q';
+
+	// The rest of the sequence is already there
+	if (key == '\033' && poll(&pfd, 1, 0) > 0 &&
+	    read(STDIN_FILENO, seq, sizeof(seq)) == sizeof(seq) &&
+	    seq[0] == '[')
+		return seq[1];
+
+	return key;
+}
+
+/*
+ * Reads a generation from the status line, Enter accepts it and any other
+ * key but the digits and the backspace cancels it
+ */
+static bool readGeneration(uint64_t *generation, struct Replay *replay)
+{
+	char prompt[MAX_PROMPT];
+	char digits[21] = "";
+	size_t len = 0;
+	int key;
+
+	while (1) {
+		snprintf(prompt, MAX_PROMPT, "Generation: %s", digits);
+		render(prompt, replay);
+
+		key = readKey(-1);
+		if (key >= '0' && key <= '9' && len < sizeof(digits) - 1) {
+			digits[len++] = key;
+			digits[len] = '\0';
+		} else if ((key == 127 || key == '\b') && len) {
+			digits[--len] = '\0';
+		} else if (key == '\n' || key == '\r') {
+			if (!len) return false;
+			*generation = strtoull(digits, NULL, 10);
+			return true;
+		} else {
+			return false;
+		}
+	}
+}
+
+/*
+ * Zooms keeping the cell at the center of the screen
+ */
+static void setZoom(long long int zoom, struct Replay *replay)
+{
+	long long int centerX, centerY;
+	long long int maxZoom;
+
+	maxZoom = replay->header.x > replay->header.y?
+		replay->header.x : replay->header.y;
+	if (zoom < 1 || zoom > 2 * maxZoom) return;
+
+	centerX = replay->top + replay->rows / 2 * replay->zoom;
+	centerY = replay->left + replay->cols / 2 * replay->zoom;
+
+	replay->zoom = zoom;
+	replay->top = centerX - replay->rows / 2 * zoom;
+	replay->left = centerY - replay->cols / 2 * zoom;
+
+	pan(0, 0, replay);
+}
+
+/*
+ * Moves a quarter of the screen in each direction, and keeps the screen over
+ * the world
+ */
+static void pan(int dx, int dy, struct Replay *replay)
+{
+	long long int maxTop, maxLeft;
+
+	replay->top += dx * (replay->rows / 4 + 1) * replay->zoom;
+	replay->left += dy * (replay->cols / 4 + 1) * replay->zoom;
+
+	maxTop = (long long int)replay->header.x - replay->rows * replay->zoom;
+	maxLeft = (long long int)replay->header.y - replay->cols * replay->zoom;
+
+	if (replay->top > maxTop) replay->top = maxTop;
+	if (replay->left > maxLeft) replay->left = maxLeft;
+	if (replay->top < 0) replay->top = 0;
+	if (replay->left < 0) replay->left = 0;
+}
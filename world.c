@@ -1,6 +1,9 @@
 #include "world.h"
+#include "cycle.h"
 #include "list.h"
 #include "malloc.h"
+#include "pages.h"
+#include "density.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -12,6 +15,33 @@
 #define NB_BOT (1<<2)
 #define NB_ALL (NB_TOP | NB_MID | NB_BOT)
 
+// Tiles are squares of (1 << TILE_SHIFT) cells per side
+#define TILE_SHIFT 3
+#define TILE_CELLS (1 << (2*TILE_SHIFT))
+
+// Cells reserved at once
+#define CELL_BLOCK 4096
+
+/*
+ * Neighbors grouped by rows: x+1 (NB_TOP), x (NB_MID) and x-1 (NB_BOT), so
+ * each combination of rows is a range of them
+ */
+static const wsize_t neighborX[8] = { 1, 1, 1,  0, 0, -1, -1, -1};
+static const wsize_t neighborY[8] = {-1, 0, 1, -1, 1, -1,  0,  1};
+static const int neighborRange[NB_ALL + 1][2] = {
+	[NB_TOP]          = {0, 3},
+	[NB_TOP | NB_MID] = {0, 5},
+	[NB_MID | NB_BOT] = {3, 8},
+	[NB_BOT]          = {5, 8},
+	[NB_ALL]          = {0, 8}
+};
+
+struct Tile {
+	struct list_head monitoredCells;
+	bool changed;
+	bool active;
+};
+
 struct World {
 	wsize_t x;
 	wsize_t y;
@@ -20,9 +50,54 @@ struct World {
 	struct Boundary *TXBoundary;
 	struct Boundary *RXBoundary;
 
-	struct Cell ***grid;
-	struct list_head monitoredCells;
+	// Cells with a ghost border, pointing to the cells at the opposite edge
+	struct Cell **gridMem;
+	struct Cell **grid;
+	wsize_t stride;
+	windex_t offsets[8];
 	unsigned int numMonCells;
+
+	// Cells are reserved in blocks. Deleted cells are reused before the
+	// free space of the last block.
+	struct Cell **cellBlocks;
+	unsigned int numCellBlocks;
+	unsigned int maxCellBlocks;
+	size_t blockUsed;
+	size_t blockSize;
+	size_t firstBlockSize;
+	struct list_head freeCells;
+	unsigned long long int allocations;
+
+	// Block left by the last sort, reused by the next one, and the cells
+	// ordered by each sort
+	struct Cell *spareBlock;
+	size_t spareSize;
+	struct SortedCell *sorted;
+	size_t maxSorted;
+
+	wsize_t xOffset;
+	uint64_t hash;
+
+	// Alive cells, in total and by row and column of tiles, and changes
+	// since the last census
+	unsigned long long int population;
+	unsigned int *rowPopulation;
+	unsigned int *colPopulation;
+	unsigned long long int births;
+	unsigned long long int deaths;
+
+	struct Tile *tiles;
+	wsize_t tilesX;
+	wsize_t tilesY;
+	unsigned int *changedTiles;
+	unsigned int numChangedTiles;
+	unsigned int *activeTiles;
+	unsigned int numActiveTiles;
+};
+
+struct SortedCell {
+	unsigned long long int key;
+	struct Cell *cell;
 };
 
 struct Cell {
@@ -38,31 +113,73 @@ unsigned int boundaryMaxSize;
 
 // Auxiliary functions
 static struct Cell *newCell(wsize_t x, wsize_t y, unsigned char num_ref,
-	bool alive);
+	bool alive, struct World *world);
 static void addCell(struct Cell *cell, struct World *world);
+static void addCellBlock(size_t size, struct World *world);
+static void pushCellBlock(struct Cell *block, size_t size,
+	struct World *world);
+static void freeCellBlocks(struct Cell **blocks, unsigned int numBlocks);
 static void deleteCell(struct Cell *cell, struct World *world);
-static void setNeighbor(wsize_t x, wsize_t y, unsigned bound,
-	void (*setRef)(wsize_t, wsize_t, struct World *),
+static void setSlot(wsize_t x, wsize_t y, struct Cell *cell,
+	struct World *world);
+static void setNeighbor(wsize_t x, wsize_t y, unsigned bound, bool inc,
 	struct World *world);
-static void incRef(wsize_t x, wsize_t y, struct World *world);
-static void decRef(wsize_t x, wsize_t y, struct World *world);
 static void toroidalCoords(wsize_t *x, wsize_t *y, const struct World *world);
 static struct Boundary *createBoundary(void);
 static void freeBoundary(struct Boundary *boundary);
 static void addToBoundary(wsize_t y, enum WorldBound bound,
 	enum BoundaryType btype, struct Boundary *boundary);
+static unsigned int tileIndex(wsize_t x, wsize_t y, const struct World *world);
+static void markTile(wsize_t x, wsize_t y, struct World *world);
+static void markRowTiles(wsize_t x, wsize_t y, struct World *world);
+static void markTileIndex(wsize_t tx, wsize_t ty, struct World *world);
+static int compareTiles(const void *a, const void *b);
+static int compareCells(const void *a, const void *b);
+static void countCell(wsize_t x, wsize_t y, int inc, struct World *world);
+static void rowBounds(wsize_t tx, wsize_t *minX, wsize_t *maxX,
+	const struct World *world);
+static void colBounds(wsize_t ty, wsize_t *minY, wsize_t *maxY,
+	const struct World *world);
+
+
+/*
+ * Whether the coordinates and cell indices of a world of that size, ghost cells
+ * included, fit the widths of this build
+ */
+bool worldFits(long long int x, long long int y)
+{
+	if (x > WSIZE_MAX - 2 || y > WSIZE_MAX - 2) return false;
 
+	return (x + 2) <= WINDEX_MAX / (y + 2);
+}
 
 struct World *createWorld(wsize_t x, wsize_t y, unsigned char limits)
 {
 	struct World *world;
-	struct Cell **grid;
 	wsize_t i, j;
+	wsize_t stride;
+	wsize_t tilesX, tilesY;
+	windex_t tile;
+	int k;
+
+	tilesX = ((x - 1) >> TILE_SHIFT) + 1;
+	tilesY = ((y - 1) >> TILE_SHIFT) + 1;
+	stride = y + 2;
 
 	// Allocate memory
 	world = (struct World *) mallocC(sizeof(struct World));
-	world->grid = (struct Cell ***)mallocC(x * sizeof(struct Cell *));
-	grid = (struct Cell **)mallocC(x * y * sizeof(struct Cell *));
+	world->gridMem = (struct Cell **)
+		mallocLarge((size_t)(x + 2) * stride * sizeof(struct Cell *));
+	world->tiles = (struct Tile *)
+		mallocC((size_t)tilesX * tilesY * sizeof(struct Tile));
+	world->changedTiles = (unsigned int *)
+		mallocC((size_t)tilesX * tilesY * sizeof(unsigned int));
+	world->activeTiles = (unsigned int *)
+		mallocC((size_t)tilesX * tilesY * sizeof(unsigned int));
+	world->rowPopulation = (unsigned int *)
+		mallocC(tilesX * sizeof(unsigned int));
+	world->colPopulation = (unsigned int *)
+		mallocC(tilesY * sizeof(unsigned int));
 
 	if (limits) {
 		boundaryMaxSize = y * sizeof(wsize_t);
@@ -70,19 +187,54 @@ struct World *createWorld(wsize_t x, wsize_t y, unsigned char limits)
 		world->TXBoundary = createBoundary();
 	}
 
-	// Initialize pointers
-	for (i = 0; i < x; ++i) {
-		world->grid[i] = &grid[i*y];
-		for (j = 0; j < y; ++j)
-			world->grid[i][j] = NULL;
+	// Initialize pointers, first touching each row from the thread that will
+	// most likely check it
+	world->grid = &world->gridMem[stride + 1];
+	#pragma omp parallel for schedule(static) private(j)
+	for (i = -1; i <= x; ++i) {
+		for (j = -1; j <= y; ++j)
+			world->grid[(windex_t)i*stride + j] = NULL;
+	}
+
+	for (k = 0; k < 8; ++k)
+		world->offsets[k] = (windex_t)neighborX[k] * stride + neighborY[k];
+
+	// Initialize tiles
+	for (tile = 0; tile < (windex_t)tilesX * tilesY; ++tile) {
+		INIT_LIST_HEAD(&world->tiles[tile].monitoredCells);
+		world->tiles[tile].changed = false;
+		world->tiles[tile].active = false;
 	}
 
 	// Initialize struct
 	world->x = x;
 	world->y = y;
+	world->stride = stride;
 	world->limits = limits;
-	INIT_LIST_HEAD(&world->monitoredCells);
 	world->numMonCells = 0;
+	world->cellBlocks = NULL;
+	world->numCellBlocks = 0;
+	world->maxCellBlocks = 0;
+	world->blockUsed = 0;
+	world->blockSize = 0;
+	world->firstBlockSize = 0;
+	INIT_LIST_HEAD(&world->freeCells);
+	world->allocations = 0;
+	world->spareBlock = NULL;
+	world->spareSize = 0;
+	world->sorted = NULL;
+	world->maxSorted = 0;
+	world->xOffset = 0;
+	world->hash = 0;
+	world->population = 0;
+	world->births = 0;
+	world->deaths = 0;
+	memset(world->rowPopulation, 0, tilesX * sizeof(unsigned int));
+	memset(world->colPopulation, 0, tilesY * sizeof(unsigned int));
+	world->tilesX = tilesX;
+	world->tilesY = tilesY;
+	world->numChangedTiles = 0;
+	world->numActiveTiles = 0;
 
 	return world;
 }
@@ -90,17 +242,19 @@ struct World *createWorld(wsize_t x, wsize_t y, unsigned char limits)
 static struct Boundary *createBoundary()
 {
 	struct Boundary *boundary;
+	size_t elements;
 
 	boundary = (struct Boundary *)mallocC(sizeof(struct Boundary));
+	boundary->storage = (wsize_t *)mallocC(4 * boundaryMaxSize);
 
-	boundary->boundaries[WB_TOP][TO_REVIVE] =
-		(wsize_t *)mallocC(boundaryMaxSize);
-	boundary->boundaries[WB_TOP][TO_KILL] =
-		(wsize_t *)mallocC(boundaryMaxSize);
+	// The arrays may be pointed elsewhere by the node, storage stays owned
+	elements = boundaryMaxSize / sizeof(wsize_t);
+	boundary->boundaries[WB_TOP][TO_REVIVE] = &boundary->storage[0];
+	boundary->boundaries[WB_TOP][TO_KILL] = &boundary->storage[elements];
 	boundary->boundaries[WB_BOTTOM][TO_REVIVE] =
-		(wsize_t *)mallocC(boundaryMaxSize);
+		&boundary->storage[2 * elements];
 	boundary->boundaries[WB_BOTTOM][TO_KILL] =
-		(wsize_t *)mallocC(boundaryMaxSize);
+		&boundary->storage[3 * elements];
 
 
 	boundary->boundariesSizes[WB_TOP][TO_REVIVE] = 0;
@@ -113,14 +267,15 @@ static struct Boundary *createBoundary()
 
 inline void destroyWorld(struct World *world)
 {
-	struct Cell *cell, *tmp;
-
-	list_for_each_entry_safe(cell, tmp, &world->monitoredCells, lh) {
-		list_del(&cell->lh);
-		free(cell);
-	}
-	free(world->grid[0]);
-	free(world->grid);
+	freeCellBlocks(world->cellBlocks, world->numCellBlocks);
+	free(world->spareBlock);
+	free(world->sorted);
+	freeLarge(world->gridMem);
+	free(world->tiles);
+	free(world->changedTiles);
+	free(world->activeTiles);
+	free(world->rowPopulation);
+	free(world->colPopulation);
 
 	if (world->limits) {
 		freeBoundary(world->TXBoundary);
@@ -131,10 +286,7 @@ inline void destroyWorld(struct World *world)
 
 inline static void freeBoundary(struct Boundary *boundary)
 {
-	free(boundary->boundaries[WB_TOP][TO_REVIVE]);
-	free(boundary->boundaries[WB_TOP][TO_KILL]);
-	free(boundary->boundaries[WB_BOTTOM][TO_REVIVE]);
-	free(boundary->boundaries[WB_BOTTOM][TO_KILL]);
+	free(boundary->storage);
 
 	free(boundary);
 }
@@ -142,29 +294,44 @@ inline static void freeBoundary(struct Boundary *boundary)
 inline void clearWorld(struct World *world)
 {
 	wsize_t i, j;
+	windex_t tile;
 
 	for (i = 0; i < world->x; ++i) {
 		for (j = 0; j < world->y; ++j) {
-			if (world->grid[i][j] != NULL)
-				deleteCell(world->grid[i][j], world);
+			if (getCell(i, j, world) != NULL)
+				deleteCell(getCell(i, j, world), world);
 		}
 	}
 
+	for (tile = 0; tile < (windex_t)world->tilesX * world->tilesY; ++tile) {
+		world->tiles[tile].changed = false;
+		world->tiles[tile].active = false;
+	}
+
 	world->numMonCells = 0;
+	world->numChangedTiles = 0;
+	world->numActiveTiles = 0;
+	world->hash = 0;
+	world->population = 0;
+	world->births = 0;
+	world->deaths = 0;
+	memset(world->rowPopulation, 0, world->tilesX * sizeof(unsigned int));
+	memset(world->colPopulation, 0, world->tilesY * sizeof(unsigned int));
 	clearBoundaries(world);
 }
 
 inline void clearBoundaries(struct World *world)
 {
-	world->TXBoundary->boundariesSizes[WB_TOP   ][TO_REVIVE] = 0;
-	world->TXBoundary->boundariesSizes[WB_TOP   ][TO_KILL  ] = 0;
-	world->TXBoundary->boundariesSizes[WB_BOTTOM][TO_REVIVE] = 0;
-	world->TXBoundary->boundariesSizes[WB_BOTTOM][TO_KILL  ] = 0;
+	clearBoundary(world->TXBoundary);
+	clearBoundary(world->RXBoundary);
+}
 
-	world->RXBoundary->boundariesSizes[WB_TOP   ][TO_REVIVE] = 0;
-	world->RXBoundary->boundariesSizes[WB_TOP   ][TO_KILL  ] = 0;
-	world->RXBoundary->boundariesSizes[WB_BOTTOM][TO_REVIVE] = 0;
-	world->RXBoundary->boundariesSizes[WB_BOTTOM][TO_KILL  ] = 0;
+inline void clearBoundary(struct Boundary *boundary)
+{
+	boundary->boundariesSizes[WB_TOP   ][TO_REVIVE] = 0;
+	boundary->boundariesSizes[WB_TOP   ][TO_KILL  ] = 0;
+	boundary->boundariesSizes[WB_BOTTOM][TO_REVIVE] = 0;
+	boundary->boundariesSizes[WB_BOTTOM][TO_KILL  ] = 0;
 }
 
 inline void getSize(wsize_t *x, wsize_t *y, const struct World *world)
@@ -173,12 +340,185 @@ inline void getSize(wsize_t *x, wsize_t *y, const struct World *world)
 	*y = world->y;
 }
 
+inline void setWorldOffset(wsize_t xOffset, struct World *world)
+{
+	world->xOffset = xOffset;
+}
+
+inline uint64_t getWorldHash(const struct World *world)
+{
+	return world->hash;
+}
+
+/*
+ * Starts counting the births and deaths from the current state
+ */
+inline void resetCensus(struct World *world)
+{
+	world->births = 0;
+	world->deaths = 0;
+}
+
+/*
+ * Fills the census and starts counting the births and deaths again. The
+ * bounding box is narrowed to the rows and columns of tiles with alive cells,
+ * and only the cells of the outermost ones are visited. The active tiles are
+ * those of the strip of this process, so their total depends on the split.
+ */
+void getCensus(struct Census *census, struct World *world)
+{
+	wsize_t first, last;
+	wsize_t minX = WSIZE_MAX, maxX = -1;
+	wsize_t minY = WSIZE_MAX, maxY = -1;
+
+	census->population = world->population;
+	census->births = world->births;
+	census->deaths = world->deaths;
+	census->activeTiles = world->numActiveTiles;
+	world->births = 0;
+	world->deaths = 0;
+
+	if (world->population > 0) {
+		for (first = 0; !world->rowPopulation[first]; ++first);
+		for (last = world->tilesX - 1; !world->rowPopulation[last]; --last);
+		rowBounds(first, &minX, &maxX, world);
+		rowBounds(last, &minX, &maxX, world);
+
+		for (first = 0; !world->colPopulation[first]; ++first);
+		for (last = world->tilesY - 1; !world->colPopulation[last]; --last);
+		colBounds(first, &minY, &maxY, world);
+		colBounds(last, &minY, &maxY, world);
+
+		minX += world->xOffset;
+		maxX += world->xOffset;
+	}
+
+	census->minX = minX;
+	census->maxX = maxX;
+	census->minY = minY;
+	census->maxY = maxY;
+}
+
+// Extends the rows of the box with the alive cells of a row of tiles
+static void rowBounds(wsize_t tx, wsize_t *minX, wsize_t *maxX,
+	const struct World *world)
+{
+	struct Cell *cell;
+	wsize_t ty;
+
+	for (ty = 0; ty < world->tilesY; ++ty) {
+		list_for_each_entry(cell,
+			&world->tiles[(unsigned int)tx * world->tilesY + ty].monitoredCells, lh)
+		{
+			if (!cell->alive) continue;
+			if (cell->x < *minX) *minX = cell->x;
+			if (cell->x > *maxX) *maxX = cell->x;
+		}
+	}
+}
+
+// Extends the columns of the box with the alive cells of a column of tiles
+static void colBounds(wsize_t ty, wsize_t *minY, wsize_t *maxY,
+	const struct World *world)
+{
+	struct Cell *cell;
+	wsize_t tx;
+
+	for (tx = 0; tx < world->tilesX; ++tx) {
+		list_for_each_entry(cell,
+			&world->tiles[(unsigned int)tx * world->tilesY + ty].monitoredCells, lh)
+		{
+			if (!cell->alive) continue;
+			if (cell->y < *minY) *minY = cell->y;
+			if (cell->y > *maxY) *maxY = cell->y;
+		}
+	}
+}
+
+inline unsigned long long int getPopulation(const struct World *world)
+{
+	return world->population;
+}
+
+void addDensity(struct DensityMap *map, const struct World *world)
+{
+	struct Cell *cell;
+	windex_t i;
+
+	#pragma omp parallel for schedule(dynamic, 64) private(cell)
+	for (i = 0; i < (windex_t)world->tilesX * world->tilesY; ++i) {
+		list_for_each_entry(cell, &world->tiles[i].monitoredCells, lh) {
+			if (!cell->alive) continue;
+
+			#pragma omp atomic
+			map->counts[map->rowBlock[cell->x] * map->cols +
+				map->colBlock[cell->y]]++;
+		}
+	}
+}
+
+/*
+ * Sets the bits of the alive cells inside the packed rows and columns. A
+ * window with less cells than the monitored ones is read from the grid, so
+ * the cost depends on its size instead of the world.
+ */
+void packWorld(struct PackedRows *packed, const struct World *world)
+{
+	struct Cell *cell;
+	unsigned char *byte;
+	windex_t i;
+	wsize_t j;
+
+	if ((windex_t)(packed->x1 - packed->x0) * (packed->y1 - packed->y0) <
+	    (windex_t)world->numMonCells) {
+		#pragma omp parallel for schedule(static) private(j, cell, byte)
+		for (i = packed->x0; i < packed->x1; ++i) {
+			byte = &packed->rows[
+				(i - packed->x0) * packed->rowBytes];
+
+			for (j = packed->y0; j < packed->y1; ++j) {
+				cell = world->grid[(windex_t)i*world->stride + j];
+				if (cell && cell->alive)
+					byte[(j - packed->y0) / 8] |=
+						1 << ((j - packed->y0) % 8);
+			}
+		}
+		return;
+	}
+
+	#pragma omp parallel for schedule(dynamic, 64) private(cell, byte)
+	for (i = 0; i < (windex_t)world->tilesX * world->tilesY; ++i) {
+		list_for_each_entry(cell, &world->tiles[i].monitoredCells, lh) {
+			if (!cell->alive ||
+			    cell->x < packed->x0 || cell->x >= packed->x1 ||
+			    cell->y < packed->y0 || cell->y >= packed->y1)
+				continue;
+
+			byte = &packed->rows[
+				(cell->x - packed->x0) * packed->rowBytes +
+				(cell->y - packed->y0) / 8];
+
+			#pragma omp atomic
+			*byte |= 1 << ((cell->y - packed->y0) % 8);
+		}
+	}
+}
+
 inline static struct Cell *newCell(wsize_t x, wsize_t y, unsigned char num_ref,
-	bool alive)
+	bool alive, struct World *world)
 {
 	struct Cell *cell;
 
-	cell = (struct Cell *)mallocC(sizeof(struct Cell));
+	if (!list_empty(&world->freeCells)) {
+		cell = list_entry(world->freeCells.next, struct Cell, lh);
+		list_del(&cell->lh);
+	} else {
+		if (world->blockUsed == world->blockSize)
+			addCellBlock(CELL_BLOCK, world);
+		cell = &world->cellBlocks[world->numCellBlocks - 1]
+			[world->blockUsed++];
+	}
+
 	cell->x = x;
 	cell->y = y;
 	cell->num_ref = num_ref;
@@ -187,58 +527,180 @@ inline static struct Cell *newCell(wsize_t x, wsize_t y, unsigned char num_ref,
 	return cell;
 }
 
-static void addCell(struct Cell *cell, struct World *world)
+static void addCellBlock(size_t size, struct World *world)
 {
-	list_add(&cell->lh, &world->monitoredCells);
-	world->grid[cell->x][cell->y] = cell;
-	++(world->numMonCells);
+	pushCellBlock((struct Cell *)mallocC(size * sizeof(struct Cell)), size,
+		world);
+	++(world->allocations);
 }
 
-inline static void incRef(wsize_t x, wsize_t y, struct World *world)
+static void pushCellBlock(struct Cell *block, size_t size,
+	struct World *world)
 {
-	struct Cell *cell;
+	if (world->numCellBlocks == world->maxCellBlocks) {
+		world->maxCellBlocks = world->maxCellBlocks?
+			2 * world->maxCellBlocks : 16;
+		world->cellBlocks = (struct Cell **)reallocC(world->cellBlocks,
+			world->maxCellBlocks * sizeof(struct Cell *));
+	}
 
-	toroidalCoords(&x, &y, world);
+	world->cellBlocks[world->numCellBlocks++] = block;
+	world->blockUsed = 0;
+	world->blockSize = size;
+	if (world->numCellBlocks == 1) world->firstBlockSize = size;
+}
 
-	if (world->grid[x][y] != NULL)
-		++(world->grid[x][y]->num_ref);
-	else {
-		cell = newCell(x, y, 1, false);
-		addCell(cell, world);
-	}
+static void freeCellBlocks(struct Cell **blocks, unsigned int numBlocks)
+{
+	unsigned int i;
+
+	for (i = 0; i < numBlocks; ++i)
+		free(blocks[i]);
+	free(blocks);
 }
 
-inline void decRef(wsize_t x, wsize_t y, struct World *world)
+/*
+ * Moves all the cells to a single block, in the order the tiles are checked
+ * and by rows inside each tile, so the cells processed together are close in
+ * memory. Deletions and births scatter them again over time.
+ *
+ * Only the cells in the blocks are visited, deleted ones have a negative x.
+ * The block they leave is kept for the next sort, so a world that doesn't
+ * grow is sorted without reserving memory.
+ */
+void sortCells(struct World *world)
 {
-	struct Cell *cell;
+	const wsize_t mask = (1 << TILE_SHIFT) - 1;
+	struct Cell *block, *cell, *moved;
+	struct list_head *head = NULL;
+	size_t numSorted = 0, size, used, i;
+	unsigned int b, tile, lastTile = 0;
+
+	if (world->numMonCells > world->maxSorted) {
+		world->maxSorted = world->numMonCells + CELL_BLOCK;
+		world->sorted = (struct SortedCell *)reallocC(world->sorted,
+			world->maxSorted * sizeof(struct SortedCell));
+	}
 
-	toroidalCoords(&x, &y, world);
+	// Blocks between the first and the last one are full
+	for (b = 0; b < world->numCellBlocks; ++b) {
+		block = world->cellBlocks[b];
+		used = b == world->numCellBlocks - 1? world->blockUsed :
+			b == 0? world->firstBlockSize : CELL_BLOCK;
+		for (i = 0; i < used; ++i) {
+			cell = &block[i];
+			if (cell->x < 0) continue;
+
+			world->sorted[numSorted].key = (unsigned long long int)
+				tileIndex(cell->x, cell->y, world) * TILE_CELLS +
+				((cell->x & mask) << TILE_SHIFT) + (cell->y & mask);
+			world->sorted[numSorted].cell = cell;
+			++numSorted;
+		}
+	}
+	qsort(world->sorted, numSorted, sizeof(struct SortedCell),
+		compareCells);
+
+	if (world->spareBlock && world->spareSize >= numSorted + CELL_BLOCK/2) {
+		block = world->spareBlock;
+		size = world->spareSize;
+	} else {
+		free(world->spareBlock);
+		size = numSorted + CELL_BLOCK;
+		block = (struct Cell *)mallocC(size * sizeof(struct Cell));
+		++(world->allocations);
+	}
+
+	for (i = 0; i < numSorted; ++i) {
+		tile = world->sorted[i].key / TILE_CELLS;
+		if (head == NULL || tile != lastTile) {
+			head = &world->tiles[tile].monitoredCells;
+			INIT_LIST_HEAD(head);
+			lastTile = tile;
+		}
 
-	cell = world->grid[x][y];
-	if (cell == NULL) return;
+		moved = &block[i];
+		*moved = *world->sorted[i].cell;
+		list_add_tail(&moved->lh, head);
+		setSlot(moved->x, moved->y, moved, world);
+	}
+
+	// The first block was left by the last sort, or reserved first
+	world->spareBlock = world->numCellBlocks? world->cellBlocks[0] : NULL;
+	world->spareSize = world->firstBlockSize;
+	for (b = 1; b < world->numCellBlocks; ++b)
+		free(world->cellBlocks[b]);
 
-	--(cell->num_ref);
-	if (!cell->alive && cell->num_ref <= 0)
-		deleteCell(cell, world);
+	world->numCellBlocks = 0;
+	INIT_LIST_HEAD(&world->freeCells);
+	pushCellBlock(block, size, world);
+	world->blockUsed = numSorted;
 }
 
-static void setNeighbor(wsize_t x, wsize_t y, unsigned bound,
-	void (*setRef)(wsize_t, wsize_t, struct World *),
+static void addCell(struct Cell *cell, struct World *world)
+{
+	struct Tile *tile = &world->tiles[tileIndex(cell->x, cell->y, world)];
+
+	list_add(&cell->lh, &tile->monitoredCells);
+	setSlot(cell->x, cell->y, cell, world);
+	++(world->numMonCells);
+}
+
+/*
+ * Cells at the edges are also stored in the ghost border at the opposite
+ * side, so the neighbors of any cell are at fixed offsets without wrapping
+ */
+static void setSlot(wsize_t x, wsize_t y, struct Cell *cell,
 	struct World *world)
 {
-	if (bound & NB_TOP) {
-		setRef(x+1, y, world);
-		setRef(x+1, y-1, world);
-		setRef(x+1, y+1, world);
-	}
-	if (bound & NB_MID) {
-		setRef(x, y-1, world);
-		setRef(x, y+1, world);
+	wsize_t xs[3], ys[3];
+	int nx = 0, ny = 0;
+	int i, j;
+
+	xs[nx++] = x;
+	if (x == 0)            xs[nx++] = world->x;
+	if (x == world->x - 1) xs[nx++] = -1;
+	ys[ny++] = y;
+	if (y == 0)            ys[ny++] = world->y;
+	if (y == world->y - 1) ys[ny++] = -1;
+
+	for (i = 0; i < nx; ++i) {
+		for (j = 0; j < ny; ++j)
+			world->grid[(windex_t)xs[i]*world->stride + ys[j]] =
+				cell;
 	}
-	if (bound & NB_BOT) {
-		setRef(x-1, y, world);
-		setRef(x-1, y-1, world);
-		setRef(x-1, y+1, world);
+}
+
+/*
+ * Adds or removes the reference of cell (x, y) to the neighbors in the given
+ * rows. Only a new neighbor needs its coordinates wrapped.
+ */
+inline static void setNeighbor(wsize_t x, wsize_t y, unsigned bound, bool inc,
+	struct World *world)
+{
+	struct Cell **center = &world->grid[(windex_t)x*world->stride + y];
+	struct Cell *cell;
+	wsize_t nx, ny;
+	int k;
+
+	for (k = neighborRange[bound][0]; k < neighborRange[bound][1]; ++k) {
+		cell = center[world->offsets[k]];
+
+		if (inc) {
+			if (cell != NULL) {
+				++(cell->num_ref);
+			} else {
+				nx = x + neighborX[k];
+				ny = y + neighborY[k];
+				toroidalCoords(&nx, &ny, world);
+				addCell(newCell(nx, ny, 1, false, world),
+					world);
+			}
+		} else if (cell != NULL) {
+			--(cell->num_ref);
+			if (!cell->alive && cell->num_ref <= 0)
+				deleteCell(cell, world);
+		}
 	}
 }
 
@@ -247,7 +709,7 @@ void reviveCell(wsize_t x, wsize_t y, struct World *world)
 	struct Cell *cell;
 	unsigned bound = NB_ALL;
 
-	cell = world->grid[x][y];
+	cell = getCell(x, y, world);
 
 	if (world->limits) {
 		if (x == 0) {
@@ -264,22 +726,30 @@ void reviveCell(wsize_t x, wsize_t y, struct World *world)
 	}
 
 	if (cell == NULL) {
-		cell = newCell(x, y, 0, true);
+		cell = newCell(x, y, 0, true, world);
 		addCell(cell, world);
-		setNeighbor(x, y, bound, incRef, world);
+		setNeighbor(x, y, bound, true, world);
+		markTile(x, y, world);
+		countCell(x, y, 1, world);
+		world->hash ^= zobristKey(x + world->xOffset, y);
 	}
 	else if (!cell->alive) {
-		setNeighbor(x, y, bound, incRef, world);
+		setNeighbor(x, y, bound, true, world);
 		cell->alive = true;
+		markTile(x, y, world);
+		countCell(x, y, 1, world);
+		world->hash ^= zobristKey(x + world->xOffset, y);
 	}
 }
 
-void reviveCells(struct list_head *list, struct World *world)
+void reviveCells(const struct CellVector *vector, struct World *world)
 {
-	struct CellListNode *cln;
+	size_t i;
 
-	list_for_each_entry(cln, list, lh)
-		reviveCell(cln->cell->x, cln->cell->y, world);
+	for (i = 0; i < vector->size; ++i) {
+		reviveCell(vector->cells[i] / world->y,
+			vector->cells[i] % world->y, world);
+	}
 }
 
 void killCell(wsize_t x, wsize_t y, struct World *world)
@@ -287,7 +757,10 @@ void killCell(wsize_t x, wsize_t y, struct World *world)
 	struct Cell *cell;
 	unsigned bound = NB_ALL;
 
-	cell = world->grid[x][y];
+	cell = getCell(x, y, world);
+
+	// A dead cell holds no references to remove
+	if (cell == NULL || !cell->alive) return;
 
 	if (world->limits) {
 		if (x == 0) {
@@ -299,25 +772,49 @@ void killCell(wsize_t x, wsize_t y, struct World *world)
 		}
 	}
 
-	setNeighbor(x, y, bound, decRef, world);
-	if (cell != NULL && cell->alive) {
-		cell->alive = false;
-	}
+	setNeighbor(x, y, bound, false, world);
+	cell->alive = false;
+	markTile(x, y, world);
+	countCell(x, y, -1, world);
+	world->hash ^= zobristKey(x + world->xOffset, y);
+}
+
+inline static void countCell(wsize_t x, wsize_t y, int inc,
+	struct World *world)
+{
+	world->population += inc;
+	world->rowPopulation[x >> TILE_SHIFT] += inc;
+	world->colPopulation[y >> TILE_SHIFT] += inc;
+	if (inc > 0)
+		++(world->births);
+	else
+		++(world->deaths);
 }
 
-void killCells(struct list_head *list, struct World *world)
+void killCells(const struct CellVector *vector, struct World *world)
 {
-	struct CellListNode *cln;
+	size_t i;
+
+	for (i = 0; i < vector->size; ++i) {
+		killCell(vector->cells[i] / world->y,
+			vector->cells[i] % world->y, world);
+	}
+}
 
-	list_for_each_entry(cln, list, lh)
-		killCell(cln->cell->x, cln->cell->y, world);
+/*
+ * Blocks of cells allocated since the world was created
+ */
+inline unsigned long long int getAllocations(const struct World *world)
+{
+	return world->allocations;
 }
 
 static void deleteCell(struct Cell *cell, struct World *world)
 {
 	list_del(&cell->lh);
-	world->grid[cell->x][cell->y] = NULL;
-	free(cell);
+	setSlot(cell->x, cell->y, NULL, world);
+	list_add(&cell->lh, &world->freeCells);
+	cell->x = -1;
 	--(world->numMonCells);
 }
 
@@ -344,31 +841,36 @@ void setBoundary(enum WorldBound bound, enum BoundaryType btype,
 	int i;
 	wsize_t x_coord;
 	wsize_t y_coord;
+	wsize_t x_changed;
 	wsize_t bsize;
-	void (*setRef)(wsize_t, wsize_t, struct World *);
+	bool inc;
 	unsigned neighborBounds;
 
 	bsize = world->RXBoundary->boundariesSizes[bound][btype];
 
+	// The top neighbor's bottom row lies just above our first row, and the
+	// bottom neighbor's top row just below our last row
 	switch (bound) {
 		case WB_TOP:
-			x_coord = world->x;
-			neighborBounds = NB_BOT;
-			break;
-		case WB_BOTTOM:
 			x_coord = -1;
+			x_changed = 0;
 			neighborBounds = NB_TOP;
 			break;
+		case WB_BOTTOM:
+			x_coord = world->x;
+			x_changed = world->x - 1;
+			neighborBounds = NB_BOT;
+			break;
 		default:
 			return;
 	};
 
 	switch (btype) {
 		case TO_REVIVE:
-			setRef = incRef;
+			inc = true;
 			break;
 		case TO_KILL:
-			setRef = decRef;
+			inc = false;
 			break;
 		default:
 			return;
@@ -376,7 +878,8 @@ void setBoundary(enum WorldBound bound, enum BoundaryType btype,
 
 	for (i = 0; i < bsize; i++) {
 		y_coord = world->RXBoundary->boundaries[bound][btype][i];
-		setNeighbor(x_coord, y_coord, neighborBounds, setRef, world);
+		setNeighbor(x_coord, y_coord, neighborBounds, inc, world);
+		markRowTiles(x_changed, y_coord, world);
 	}
 }
 
@@ -389,8 +892,12 @@ inline void getBoundaries(struct Boundary **tx, struct Boundary **rx,
 
 char dgetCellRefs(wsize_t x, wsize_t y, const struct World *world)
 {
+	struct Cell *cell;
+
 	toroidalCoords(&x, &y, world);
-	return world->grid[x][y] == NULL? 0 : world->grid[x][y]->num_ref;
+	cell = getCell(x, y, world);
+
+	return cell == NULL? 0 : cell->num_ref;
 }
 
 inline char getCellRefs(struct Cell *cell)
@@ -407,111 +914,206 @@ inline bool isCellAlive_coord(wsize_t x, wsize_t y, const struct World *world)
 {
 	struct Cell *cell;
 
-	cell = world->grid[x][y];
+	cell = getCell(x, y, world);
 
 	return cell == NULL? false : cell->alive;
 }
 
 inline struct Cell *getCell(wsize_t x, wsize_t y, const struct World *world)
 {
-	return world->grid[x][y];
+	return world->grid[(windex_t)x*world->stride + y];
 }
 
-void addToList(struct Cell *cell, struct list_head *list)
+void initVector(struct CellVector *vector)
 {
-	struct CellListNode *cellList;
+	vector->cells = NULL;
+	vector->size = 0;
+	vector->capacity = 0;
+	vector->growths = 0;
+}
 
-	cellList = (struct CellListNode *)mallocC(sizeof(struct CellListNode));
-	cellList->cell = cell;
-	list_add(&cellList->lh, list);
+void freeVector(struct CellVector *vector)
+{
+	free(vector->cells);
+	initVector(vector);
 }
 
-void addToList_coords(wsize_t x, wsize_t y, bool alive, struct list_head *list,
-	struct World *world)
+/*
+ * Empties the vector, keeping its memory for the next generation
+ */
+inline void clearVector(struct CellVector *vector)
+{
+	vector->size = 0;
+}
+
+inline void addToVector(const struct Cell *cell, struct CellVector *vector,
+	const struct World *world)
 {
-	struct CellListNode *cellList;
+	// Grows to the highest number of cells seen so far
+	if (vector->size == vector->capacity) {
+		vector->capacity = vector->capacity? 2 * vector->capacity : 1024;
+		vector->cells = (windex_t *)reallocC(vector->cells,
+			vector->capacity * sizeof(windex_t));
+		++(vector->growths);
+	}
+
+	vector->cells[vector->size++] = (windex_t)cell->x * world->y + cell->y;
+}
 
+void addToVector_coords(wsize_t x, wsize_t y, struct CellVector *vector,
+	const struct World *world)
+{
+	struct Cell cell;
+
+	// Seeding coordinates may lie several worlds away
+	x %= world->x;
+	y %= world->y;
 	toroidalCoords(&x, &y, world);
 
-	cellList = (struct CellListNode *)mallocC(sizeof(struct CellListNode));
-	cellList->cell = newCell(x, y, 0, alive);
-	list_add(&cellList->lh, list);
+	cell.x = x;
+	cell.y = y;
+	addToVector(&cell, vector, world);
 }
 
-void freeList(struct list_head *list)
+inline static unsigned int tileIndex(wsize_t x, wsize_t y,
+	const struct World *world)
 {
-	struct CellListNode *cellList, *tmp;
+	return (x >> TILE_SHIFT) * world->tilesY + (y >> TILE_SHIFT);
+}
 
-	list_for_each_entry_safe(cellList, tmp, list, lh) {
-		list_del(&cellList->lh);
-		free(cellList);
+/*
+ * A change in a cell can only affect its own neighborhood, so all the tiles
+ * overlapped by it are marked to be checked in the next generation
+ */
+inline static void markTile(wsize_t x, wsize_t y, struct World *world)
+{
+	wsize_t tx[3], ty[3];
+	int i, j;
+
+	tx[0] = (x == 0? world->x - 1 : x - 1) >> TILE_SHIFT;
+	tx[1] = x >> TILE_SHIFT;
+	tx[2] = (x == world->x - 1? 0 : x + 1) >> TILE_SHIFT;
+	ty[0] = (y == 0? world->y - 1 : y - 1) >> TILE_SHIFT;
+	ty[1] = y >> TILE_SHIFT;
+	ty[2] = (y == world->y - 1? 0 : y + 1) >> TILE_SHIFT;
+
+	for (i = 0; i < 3; ++i) {
+		for (j = 0; j < 3; ++j)
+			markTileIndex(tx[i], ty[j], world);
 	}
 }
 
-inline struct Cell *wit_first(const struct World *world)
+/*
+ * A boundary only changes the references of the cells in the row next to it,
+ * so only their tiles are marked
+ */
+inline static void markRowTiles(wsize_t x, wsize_t y, struct World *world)
 {
-	return list_entry(world->monitoredCells.next, struct Cell, lh);
+	wsize_t tx = x >> TILE_SHIFT;
+
+	markTileIndex(tx, (y == 0? world->y - 1 : y - 1) >> TILE_SHIFT, world);
+	markTileIndex(tx, y >> TILE_SHIFT, world);
+	markTileIndex(tx, (y == world->y - 1? 0 : y + 1) >> TILE_SHIFT, world);
 }
 
-inline struct Cell *wit_first_safe(const struct World *world, struct Cell **tmp)
+inline static void markTileIndex(wsize_t tx, wsize_t ty, struct World *world)
 {
-	struct Cell *cell;
+	unsigned int indx = (unsigned int)tx * world->tilesY + ty;
 
-	cell = list_entry(world->monitoredCells.next, struct Cell, lh);
-	*tmp = list_entry(cell->lh.next, struct Cell, lh);
+	if (!world->tiles[indx].changed) {
+		world->tiles[indx].changed = true;
+		world->changedTiles[world->numChangedTiles++] = indx;
+	}
+}
 
-	return cell;
+static int compareTiles(const void *a, const void *b)
+{
+	unsigned int ta = *(const unsigned int *)a;
+	unsigned int tb = *(const unsigned int *)b;
+
+	return (ta > tb) - (ta < tb);
 }
 
-struct Cell *wit_first_split(unsigned int *count, unsigned int indx,
-	const struct World *world)
+static int compareCells(const void *a, const void *b)
+{
+	unsigned long long int ka = ((const struct SortedCell *)a)->key;
+	unsigned long long int kb = ((const struct SortedCell *)b)->key;
+
+	return (ka > kb) - (ka < kb);
+}
+
+/*
+ * Only the tiles marked during the last generation can change, the rest of
+ * them are stable and they are skipped
+ */
+void updateActiveTiles(struct World *world)
 {
-	struct list_head *cell;
 	unsigned int i;
+	unsigned int *tmp;
+
+	for (i = 0; i < world->numActiveTiles; ++i)
+		world->tiles[world->activeTiles[i]].active = false;
 
-	*count = indx;
-	cell = world->monitoredCells.next;
-	for (i = 0; i < indx; ++i)
-		cell = cell->next;
+	for (i = 0; i < world->numChangedTiles; ++i) {
+		world->tiles[world->changedTiles[i]].changed = false;
+		world->tiles[world->changedTiles[i]].active = true;
+	}
+
+	tmp = world->activeTiles;
+	world->activeTiles = world->changedTiles;
+	world->numActiveTiles = world->numChangedTiles;
+	world->changedTiles = tmp;
+	world->numChangedTiles = 0;
 
-	return list_entry(cell, struct Cell, lh);
+	// Keep memory order between tiles
+	qsort(world->activeTiles, world->numActiveTiles, sizeof(unsigned int),
+		compareTiles);
 }
 
-inline bool wit_done(const struct Cell *cell, const struct World *world)
+inline unsigned int getNumActiveTiles(const struct World *world)
 {
-	return &cell->lh != &world->monitoredCells;
+	return world->numActiveTiles;
 }
 
-inline bool wit_done_split(unsigned int count, const struct World *world)
+inline unsigned int getActiveTile(unsigned int indx,
+	const struct World *world)
 {
-	return count < world->numMonCells;
+	return world->activeTiles[indx];
 }
 
-inline struct Cell *wit_next(const struct Cell *cell)
+inline void getTiles(wsize_t *tilesX, wsize_t *tilesY,
+	const struct World *world)
 {
-	return list_entry(cell->lh.next, struct Cell, lh);
+	*tilesX = world->tilesX;
+	*tilesY = world->tilesY;
 }
 
-inline struct Cell *wit_next_safe(struct Cell **tmp)
+/*
+ * Whether the tile has to be checked, because it was active at the start of
+ * the generation or it has been marked since then
+ */
+inline bool isTileActive(unsigned int indx, const struct World *world)
 {
-	struct Cell *cell;
+	return world->tiles[indx].active || world->tiles[indx].changed;
+}
 
-	cell = *tmp;
-	*tmp = list_entry((*tmp)->lh.next, struct Cell, lh);
+inline struct Cell *wit_first_tile(unsigned int indx,
+	const struct World *world)
+{
+	struct Tile *tile = &world->tiles[indx];
 
-	return cell;
+	return list_entry(tile->monitoredCells.next, struct Cell, lh);
 }
 
-inline struct Cell *wit_next_split(const struct Cell *cell, unsigned int *count,
-	unsigned int splits)
+inline bool wit_done_tile(const struct Cell *cell, unsigned int indx,
+	const struct World *world)
 {
-	struct list_head *nextCell;
-	unsigned int i;
+	struct Tile *tile = &world->tiles[indx];
 
-	*count += splits;
-	nextCell = cell->lh.next;
-	for (i = 1; i < splits; ++i)
-		nextCell = nextCell->next;
+	return &cell->lh != &tile->monitoredCells;
+}
 
-	return list_entry(nextCell, struct Cell, lh);
+inline struct Cell *wit_next(const struct Cell *cell)
+{
+	return list_entry(cell->lh.next, struct Cell, lh);
 }
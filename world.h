@@ -3,18 +3,68 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
 #include "list.h"
 #include <mpi.h>
 
 
-#define MPI_WSIZE_T MPI_LONG_LONG_INT
-typedef long int wsize_t;
+/*
+ * Coordinates and sizes of the world are wsize_t, and indices of its cells
+ * windex_t. Their widths are chosen when building, with the WSIZE_BITS and
+ * WINDEX_BITS options, so smaller worlds take less memory and send smaller
+ * changes at limits.
+ */
+#ifndef WSIZE_BITS
+#define WSIZE_BITS 64
+#endif
+#ifndef WINDEX_BITS
+#define WINDEX_BITS 64
+#endif
+
+#if WSIZE_BITS == 16
+typedef int16_t wsize_t;
+#define WSIZE_MAX INT16_MAX
+#define MPI_WSIZE_T MPI_INT16_T
+#elif WSIZE_BITS == 32
+typedef int32_t wsize_t;
+#define WSIZE_MAX INT32_MAX
+#define MPI_WSIZE_T MPI_INT32_T
+#elif WSIZE_BITS == 64
+typedef int64_t wsize_t;
+#define WSIZE_MAX INT64_MAX
+#define MPI_WSIZE_T MPI_INT64_T
+#else
+#error "WSIZE_BITS must be 16, 32 or 64"
+#endif
+
+#if WINDEX_BITS < WSIZE_BITS
+#error "WINDEX_BITS can't be less than WSIZE_BITS"
+#elif WINDEX_BITS == 16
+typedef int16_t windex_t;
+#define WINDEX_MAX INT16_MAX
+#elif WINDEX_BITS == 32
+typedef int32_t windex_t;
+#define WINDEX_MAX INT32_MAX
+#elif WINDEX_BITS == 64
+typedef int64_t windex_t;
+#define WINDEX_MAX INT64_MAX
+#else
+#error "WINDEX_BITS must be 16, 32 or 64"
+#endif
 
 struct World;
 struct Cell;
-struct CellListNode {
-	struct list_head lh;
-	struct Cell *cell;
+struct DensityMap;
+
+/*
+ * Growable array of cells, as indices in the world, reused between
+ * generations
+ */
+struct CellVector {
+	windex_t *cells;
+	size_t size;
+	size_t capacity;
+	unsigned long long int growths;
 };
 
 enum WorldBound {
@@ -23,30 +73,69 @@ enum WorldBound {
 	WB_NONE
 };
 
+#define OPPOSITE(bound) ((bound) == WB_TOP? WB_BOTTOM : WB_TOP)
+
 enum BoundaryType {
 	TO_REVIVE = 0,
 	TO_KILL = 1
 };
 
 struct Boundary{
+	wsize_t *storage;
 	wsize_t *boundaries[2][2];
 	wsize_t boundariesSizes[2][2];
 };
 
+/*
+ * State of the world after a generation. The bounding box is in global
+ * coordinates. Without alive cells its minimums are WSIZE_MAX and its
+ * maximums -1.
+ */
+struct Census {
+	unsigned long long int population;
+	unsigned long long int births;
+	unsigned long long int deaths;
+	unsigned long long int activeTiles;
+	wsize_t minX, minY;
+	wsize_t maxX, maxY;
+};
+
+/*
+ * Rows x0..x1-1 and columns y0..y1-1 of a process packed a bit per cell, the
+ * cell j of a row is the bit j%8 of its byte j/8
+ */
+struct PackedRows {
+	wsize_t x0, x1;
+	wsize_t y0, y1;
+	size_t rowBytes;
+	unsigned char *rows;
+};
+
 extern unsigned int boundaryMaxSize;
 
 
 struct World *createWorld(wsize_t x, wsize_t y, unsigned char limits);
+bool worldFits(long long int x, long long int y);
 void destroyWorld(struct World *world);
 void clearWorld(struct World *world);
 void clearBoundaries(struct World *world);
+void clearBoundary(struct Boundary *boundary);
 
 void getSize(wsize_t *x, wsize_t *y, const struct World *world);
+void setWorldOffset(wsize_t xOffset, struct World *world);
+uint64_t getWorldHash(const struct World *world);
+unsigned long long int getPopulation(const struct World *world);
+void resetCensus(struct World *world);
+void getCensus(struct Census *census, struct World *world);
+void addDensity(struct DensityMap *map, const struct World *world);
+void packWorld(struct PackedRows *packed, const struct World *world);
 
 void reviveCell(wsize_t x, wsize_t y, struct World *world);
-void reviveCells(struct list_head *list, struct World *world);
+void reviveCells(const struct CellVector *vector, struct World *world);
 void killCell(wsize_t x, wsize_t y, struct World *world);
-void killCells(struct list_head *list, struct World *world);
+void killCells(const struct CellVector *vector, struct World *world);
+unsigned long long int getAllocations(const struct World *world);
+void sortCells(struct World *world);
 
 struct Cell *getCell(wsize_t x, wsize_t y, const struct World *world);
 char getCellRefs(struct Cell *cell);
@@ -59,20 +148,23 @@ void getBoundaries(struct Boundary **tx, struct Boundary **rx,
 void setBoundary(enum WorldBound bound, enum BoundaryType btype,
 	struct World *world);
 
-void addToList(struct Cell *cell, struct list_head *list);
-void addToList_coords(wsize_t x, wsize_t y, bool alive, struct list_head *list,
-	struct World *world);
-void freeList(struct list_head *list);
+void initVector(struct CellVector *vector);
+void freeVector(struct CellVector *vector);
+void clearVector(struct CellVector *vector);
+void addToVector(const struct Cell *cell, struct CellVector *vector,
+	const struct World *world);
+void addToVector_coords(wsize_t x, wsize_t y, struct CellVector *vector,
+	const struct World *world);
+
+void updateActiveTiles(struct World *world);
+unsigned int getNumActiveTiles(const struct World *world);
+unsigned int getActiveTile(unsigned int indx, const struct World *world);
+void getTiles(wsize_t *tilesX, wsize_t *tilesY, const struct World *world);
+bool isTileActive(unsigned int indx, const struct World *world);
 
-struct Cell *wit_first(const struct World *world);
-struct Cell *wit_first_safe(const struct World *world, struct Cell **tmp);
-struct Cell *wit_first_split(unsigned int *count, unsigned int indx,
+struct Cell *wit_first_tile(unsigned int indx, const struct World *world);
+bool wit_done_tile(const struct Cell *cell, unsigned int indx,
 	const struct World *world);
-bool wit_done(const struct Cell *cell, const struct World *world);
-bool wit_done_split(unsigned int count, const struct World *world);
 struct Cell *wit_next(const struct Cell *cell);
-struct Cell *wit_next_safe(struct Cell **tmp);
-struct Cell *wit_next_split(const struct Cell *cell, unsigned int *count,
-	unsigned int splits);
 
 #endif